@@ -0,0 +1,199 @@
+#include "ColumnarFormat.h"
+#include "Simd.h"
+
+namespace {
+
+bool isWordStream(int stream)
+{
+    return stream >= STREAM_ORIGIN_X && stream <= STREAM_SPEED;
+}
+
+// Works on both const and mutable chunks
+template <typename Chunk>
+auto wordColumn(Chunk& chunk, int stream) -> decltype(&chunk.speed[0])
+{
+    switch (stream) {
+    case STREAM_ORIGIN_X: return chunk.origin[0];
+    case STREAM_ORIGIN_Y: return chunk.origin[1];
+    case STREAM_ORIGIN_Z: return chunk.origin[2];
+    case STREAM_ANGLE_PITCH: return chunk.angles[0];
+    case STREAM_ANGLE_YAW: return chunk.angles[1];
+    default: return chunk.speed;
+    }
+}
+
+template <typename Chunk>
+auto byteColumn(Chunk& chunk, int stream) -> decltype(&chunk.keys[0])
+{
+    switch (stream) {
+    case STREAM_TIMESTAMP: return chunk.timestamp;
+    case STREAM_KEYS: return chunk.keys;
+    case STREAM_FPS: return chunk.fps;
+    case STREAM_STRAFES: return chunk.strafes;
+    case STREAM_SYNC: return chunk.sync;
+    default: return chunk.state;
+    }
+}
+
+uint32_t zigzag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+int32_t unzigzag(uint32_t value)
+{
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+uint32_t readU32(const uint8_t* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+        (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+// Single byte varints are expanded in bulk, the deltas are then summed in place by Simd::prefixSum
+bool decodeWordStream(const uint8_t* data, size_t size, ReplayColumns& frames, int stream)
+{
+    size_t offset = 0;
+    int16_t value = 0;
+
+    for (size_t chunk = 0; chunk < frames.chunkCount(); chunk++) {
+        int16_t* column = wordColumn(frames.getChunk(chunk), stream);
+        size_t chunk_frames = frames.chunkFrames(chunk);
+
+        for (size_t i = 0; i < chunk_frames;) {
+            size_t small = Simd::unzigzagBytes(data + offset, std::min(chunk_frames - i, size - offset), column + i);
+            offset += small;
+            i += small;
+            if (i == chunk_frames)
+                break;
+
+            uint32_t delta = 0;
+            for (int shift = 0;; shift += 7) {
+                if (offset >= size || shift > 28)
+                    return false;
+                uint8_t byte = data[offset++];
+                delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                if (!(byte & 0x80))
+                    break;
+            }
+
+            // Deltas wrap like the int16_t columns
+            column[i++] = static_cast<int16_t>(unzigzag(delta));
+        }
+
+        value = Simd::prefixSum(column, chunk_frames, value);
+    }
+
+    return offset == size;
+}
+
+bool decodeByteStream(const uint8_t* data, size_t size, ReplayColumns& frames, int stream)
+{
+    if (size != frames.size())
+        return false;
+
+    for (size_t chunk = 0; chunk < frames.chunkCount(); chunk++) {
+        size_t chunk_frames = frames.chunkFrames(chunk);
+        std::copy(data, data + chunk_frames, byteColumn(frames.getChunk(chunk), stream));
+        data += chunk_frames;
+    }
+
+    return true;
+}
+
+}
+
+void ColumnarFormat::encode(const ReplayColumns& frames, ByteWriter& writer)
+{
+    size_t start = writer.size();
+    writer.reserve(start + COLUMNAR_FRAME_COUNT_BYTE_SIZE + COLUMNAR_STREAM_COUNT_BYTE_SIZE +
+        STREAM_COUNT * COLUMNAR_DIRECTORY_ENTRY_BYTE_SIZE + frames.size() * MAX_FRAME_BYTE_SIZE);
+
+    writer.writeU32(static_cast<uint32_t>(frames.size()));
+    writer.writeU8(STREAM_COUNT);
+
+    // Offsets and lengths are filled in once each stream is written
+    size_t directory = writer.size();
+    std::vector<int16_t> deltas(FRAMES_PER_CHUNK);
+    std::vector<uint8_t> bytes(FRAMES_PER_CHUNK);
+    for (int stream = 0; stream < STREAM_COUNT; stream++) {
+        writer.writeU8(static_cast<uint8_t>(stream));
+        writer.writeU32(0);
+        writer.writeU32(0);
+    }
+
+    for (int stream = 0; stream < STREAM_COUNT; stream++) {
+        size_t stream_start = writer.size();
+
+        if (isWordStream(stream)) {
+            int16_t prev = 0;
+            for (size_t chunk = 0; chunk < frames.chunkCount(); chunk++) {
+                const int16_t* column = wordColumn(frames.getChunk(chunk), stream);
+                size_t chunk_frames = frames.chunkFrames(chunk);
+
+                Simd::delta(column, chunk_frames, prev, deltas.data());
+                prev = column[chunk_frames - 1];
+
+                // Runs of small deltas are written in bulk, anything larger takes the varint path
+                for (size_t i = 0; i < chunk_frames;) {
+                    size_t small = Simd::zigzagBytes(deltas.data() + i, chunk_frames - i, bytes.data());
+                    writer.writeBytes(bytes.data(), small);
+                    i += small;
+                    if (i < chunk_frames)
+                        writer.writeVarint(zigzag(deltas[i++]));
+                }
+            }
+        }
+        else {
+            for (size_t chunk = 0; chunk < frames.chunkCount(); chunk++)
+                writer.writeBytes(byteColumn(frames.getChunk(chunk), stream), frames.chunkFrames(chunk));
+        }
+
+        size_t entry = directory + stream * COLUMNAR_DIRECTORY_ENTRY_BYTE_SIZE;
+        writer.overwriteU32(entry + 1, static_cast<uint32_t>(stream_start - start));
+        writer.overwriteU32(entry + 5, static_cast<uint32_t>(writer.size() - stream_start));
+    }
+}
+
+bool ColumnarFormat::decode(const uint8_t* body, size_t size, ReplayColumns& frames, uint32_t stream_mask)
+{
+    if (size < COLUMNAR_FRAME_COUNT_BYTE_SIZE + COLUMNAR_STREAM_COUNT_BYTE_SIZE)
+        return false;
+
+    uint32_t frame_count = readU32(body);
+    uint8_t stream_count = body[COLUMNAR_FRAME_COUNT_BYTE_SIZE];
+
+    size_t directory = COLUMNAR_FRAME_COUNT_BYTE_SIZE + COLUMNAR_STREAM_COUNT_BYTE_SIZE;
+    if (size < directory + stream_count * COLUMNAR_DIRECTORY_ENTRY_BYTE_SIZE)
+        return false;
+
+    // Every stream takes at least one byte per frame, a larger count can only come from a damaged file
+    if (frame_count > size)
+        return false;
+
+    frames.clear();
+    frames.resize(frame_count);
+
+    for (uint8_t i = 0; i < stream_count; i++) {
+        const uint8_t* entry = body + directory + i * COLUMNAR_DIRECTORY_ENTRY_BYTE_SIZE;
+        uint8_t stream = entry[0];
+        uint32_t offset = readU32(entry + 1);
+        uint32_t length = readU32(entry + 5);
+
+        // Streams this version doesn't know about are skipped
+        if (stream >= STREAM_COUNT || !(stream_mask & (1u << stream)))
+            continue;
+
+        if (offset > size || length > size - offset)
+            return false;
+
+        bool valid = isWordStream(stream)
+            ? decodeWordStream(body + offset, length, frames, stream)
+            : decodeByteStream(body + offset, length, frames, stream);
+        if (!valid)
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,168 @@
+#include "EntropyCoder.h"
+
+constexpr int PROB_BITS = 11;
+constexpr uint16_t PROB_INIT = (1 << PROB_BITS) / 2;
+constexpr int MOVE_BITS = 5;
+constexpr uint32_t TOP_VALUE = (1 << 24);
+
+// One bit tree of 255 probabilities per previous byte value
+constexpr size_t CONTEXTS = 256;
+constexpr size_t PROBS_PER_CONTEXT = 256;
+
+namespace {
+
+class RangeEncoder
+{
+    ByteWriter& writer;
+    uint64_t low = 0;
+    uint32_t range = 0xFFFFFFFF;
+    uint8_t cache = 0;
+    uint64_t cache_size = 1;
+
+    void shiftLow()
+    {
+        // Carry propagation through the pending 0xFF bytes
+        if (static_cast<uint32_t>(low) < 0xFF000000 || (low >> 32) != 0) {
+            uint8_t carry = static_cast<uint8_t>(low >> 32);
+            uint8_t temp = cache;
+            do {
+                writer.writeU8(static_cast<uint8_t>(temp + carry));
+                temp = 0xFF;
+            } while (--cache_size != 0);
+            cache = static_cast<uint8_t>(low >> 24);
+        }
+        cache_size++;
+        low = (low & 0x00FFFFFF) << 8;
+    }
+
+public:
+    explicit RangeEncoder(ByteWriter& writer) : writer(writer) {}
+
+    void encodeBit(uint16_t& prob, int bit)
+    {
+        uint32_t bound = (range >> PROB_BITS) * prob;
+        if (bit == 0) {
+            range = bound;
+            prob += ((1 << PROB_BITS) - prob) >> MOVE_BITS;
+        }
+        else {
+            low += bound;
+            range -= bound;
+            prob -= prob >> MOVE_BITS;
+        }
+
+        while (range < TOP_VALUE) {
+            range <<= 8;
+            shiftLow();
+        }
+    }
+
+    void flush()
+    {
+        for (int i = 0; i < 5; i++)
+            shiftLow();
+    }
+};
+
+class RangeDecoder
+{
+    const uint8_t* data;
+    size_t size;
+    size_t offset = 0;
+    uint32_t range = 0xFFFFFFFF;
+    uint32_t code = 0;
+
+    uint8_t next()
+    {
+        // Reading past the end is reported by overrun() instead of touching memory
+        return offset < size ? data[offset++] : (offset++, 0);
+    }
+
+public:
+    RangeDecoder(const uint8_t* data, size_t size) : data(data), size(size)
+    {
+        for (int i = 0; i < 5; i++)
+            code = (code << 8) | next();
+    }
+
+    int decodeBit(uint16_t& prob)
+    {
+        uint32_t bound = (range >> PROB_BITS) * prob;
+        int bit;
+        if (code < bound) {
+            range = bound;
+            prob += ((1 << PROB_BITS) - prob) >> MOVE_BITS;
+            bit = 0;
+        }
+        else {
+            code -= bound;
+            range -= bound;
+            prob -= prob >> MOVE_BITS;
+            bit = 1;
+        }
+
+        while (range < TOP_VALUE) {
+            range <<= 8;
+            code = (code << 8) | next();
+        }
+
+        return bit;
+    }
+
+    bool overrun() const { return offset > size; }
+};
+
+}
+
+void EntropyCoder::encode(const uint8_t* data, size_t size, ByteWriter& writer)
+{
+    std::vector<uint16_t> probs(CONTEXTS * PROBS_PER_CONTEXT, PROB_INIT);
+    RangeEncoder encoder(writer);
+
+    uint8_t prev = 0;
+    for (size_t i = 0; i < size; i++) {
+        uint16_t* context = &probs[prev * PROBS_PER_CONTEXT];
+        uint8_t byte = data[i];
+
+        // Most significant bit first through the bit tree
+        size_t node = 1;
+        for (int bit = 7; bit >= 0; bit--) {
+            int value = (byte >> bit) & 1;
+            encoder.encodeBit(context[node], value);
+            node = (node << 1) | value;
+        }
+
+        prev = byte;
+    }
+
+    encoder.flush();
+}
+
+bool EntropyCoder::decode(const uint8_t* data, size_t size, size_t decoded_size, std::vector<uint8_t>& output)
+{
+    if (decoded_size / MAX_ENTROPY_RATIO > size)
+        return false;
+
+    std::vector<uint16_t> probs(CONTEXTS * PROBS_PER_CONTEXT, PROB_INIT);
+    RangeDecoder decoder(data, size);
+
+    output.reserve(output.size() + decoded_size);
+
+    uint8_t prev = 0;
+    for (size_t i = 0; i < decoded_size; i++) {
+        uint16_t* context = &probs[prev * PROBS_PER_CONTEXT];
+
+        size_t node = 1;
+        while (node < 256)
+            node = (node << 1) | decoder.decodeBit(context[node]);
+
+        // Damaged input is noticed as soon as it runs out, not after the declared size
+        if (decoder.overrun())
+            return false;
+
+        prev = static_cast<uint8_t>(node);
+        output.push_back(prev);
+    }
+
+    return true;
+}
@@ -2,10 +2,8 @@
 #include "Frame.h"
 
 
-std::vector<uint8_t> FrameData::encode()
+void FrameData::encode(ByteWriter& writer) const
 {
-    std::vector<uint8_t> packed_data;
-
     // Frame flags (3 bytes = 24 bits)
     uint32_t flags = 0;
     flags |= (1 << 0); // RLE
@@ -23,44 +21,41 @@ std::vector<uint8_t> FrameData::encode()
     flags |= (gravity ? (1 << 12) : 0); // Gravity status
 
     // Write flags to packed data (3 bytes)
-    packed_data.push_back((flags >> 16) & 0xFF);
-    packed_data.push_back((flags >> 8) & 0xFF);
-    packed_data.push_back(flags & 0xFF);
+    writer.writeU8((flags >> 16) & 0xFF);
+    writer.writeU8((flags >> 8) & 0xFF);
+    writer.writeU8(flags & 0xFF);
 
     // Encode timestamp delta (1 byte)
-    packed_data.push_back(static_cast<uint8_t>(timestamp));
+    writer.writeU8(static_cast<uint8_t>(timestamp));
 
     // Encode origin values as 2 bytes per coordinate
-    packed_data.push_back(static_cast<uint8_t>((origin[0] >> 8) & 0xFF)); // X high byte
-    packed_data.push_back(static_cast<uint8_t>(origin[0] & 0xFF));        // X low byte
-    packed_data.push_back(static_cast<uint8_t>((origin[1] >> 8) & 0xFF)); // Y high byte
-    packed_data.push_back(static_cast<uint8_t>(origin[1] & 0xFF));        // Y low byte
-    packed_data.push_back(static_cast<uint8_t>((origin[2] >> 8) & 0xFF)); // Z high byte
-    packed_data.push_back(static_cast<uint8_t>(origin[2] & 0xFF));        // Z low byte
+    writer.writeU8(static_cast<uint8_t>((origin[0] >> 8) & 0xFF)); // X high byte
+    writer.writeU8(static_cast<uint8_t>(origin[0] & 0xFF));        // X low byte
+    writer.writeU8(static_cast<uint8_t>((origin[1] >> 8) & 0xFF)); // Y high byte
+    writer.writeU8(static_cast<uint8_t>(origin[1] & 0xFF));        // Y low byte
+    writer.writeU8(static_cast<uint8_t>((origin[2] >> 8) & 0xFF)); // Z high byte
+    writer.writeU8(static_cast<uint8_t>(origin[2] & 0xFF));        // Z low byte
 
     // Encode angle values as 2 bytes per angle
-    packed_data.push_back(static_cast<uint8_t>((angles[0] >> 8) & 0xFF)); // Yaw high byte
-    packed_data.push_back(static_cast<uint8_t>(angles[0] & 0xFF));        // Yaw low byte
-    packed_data.push_back(static_cast<uint8_t>((angles[1] >> 8) & 0xFF)); // Pitch high byte
-    packed_data.push_back(static_cast<uint8_t>(angles[1] & 0xFF));        // Pitch low byte
+    writer.writeU8(static_cast<uint8_t>((angles[0] >> 8) & 0xFF)); // Yaw high byte
+    writer.writeU8(static_cast<uint8_t>(angles[0] & 0xFF));        // Yaw low byte
+    writer.writeU8(static_cast<uint8_t>((angles[1] >> 8) & 0xFF)); // Pitch high byte
+    writer.writeU8(static_cast<uint8_t>(angles[1] & 0xFF));        // Pitch low byte
 
     // Encode speed as 2 bytes
-    packed_data.push_back(static_cast<uint8_t>((speed >> 8) & 0xFF)); // Speed high byte
-    packed_data.push_back(static_cast<uint8_t>(speed & 0xFF));        // Speed low byte
+    writer.writeU8(static_cast<uint8_t>((speed >> 8) & 0xFF)); // Speed high byte
+    writer.writeU8(static_cast<uint8_t>(speed & 0xFF));        // Speed low byte
 
-    packed_data.push_back(static_cast<uint8_t>(convertKeys(keys)));
+    writer.writeU8(static_cast<uint8_t>(convertKeys(keys)));
 
-    packed_data.push_back(static_cast<uint8_t>(fps));
+    writer.writeU8(static_cast<uint8_t>(fps));
 
-    packed_data.push_back(static_cast<uint8_t>(strafes));
-    packed_data.push_back(static_cast<uint8_t>(sync));
+    writer.writeU8(static_cast<uint8_t>(strafes));
+    writer.writeU8(static_cast<uint8_t>(sync));
     
-    return packed_data;
 }
 
-std::vector<uint8_t> FrameData::encode_delta(FrameData prev_frame) {
-    std::vector<uint8_t> packed_data;
-
+void FrameData::encode_delta(ByteWriter& writer, const FrameData& prev_frame) const {
     // Flags setup (3 bytes = 24 bits)
     uint32_t flags = 0;
     int flag_position = 1; // Start from bit 1 since bit 0 is reserved for RLE
@@ -91,10 +86,10 @@ std::vector<uint8_t> FrameData::encode_delta(FrameData prev_frame) {
 
     // If RLE is set, return only the flags, as no further data is needed
     if (rle_flag) {
-        packed_data.push_back((flags >> 16) & 0xFF);
-        packed_data.push_back((flags >> 8) & 0xFF);
-        packed_data.push_back(flags & 0xFF);
-        return packed_data;
+        writer.writeU8((flags >> 16) & 0xFF);
+        writer.writeU8((flags >> 8) & 0xFF);
+        writer.writeU8(flags & 0xFF);
+        return;
     }
 
     // If RLE is not set, encode the rest of the fields
@@ -139,70 +134,88 @@ std::vector<uint8_t> FrameData::encode_delta(FrameData prev_frame) {
     flag_position++;
 
     // Write flags to packed data (3 bytes)
-    packed_data.push_back((flags >> 16) & 0xFF);
-    packed_data.push_back((flags >> 8) & 0xFF);
-    packed_data.push_back(flags & 0xFF);
+    writer.writeU8((flags >> 16) & 0xFF);
+    writer.writeU8((flags >> 8) & 0xFF);
+    writer.writeU8(flags & 0xFF);
 
     // Encode timestamp delta (1 byte)
     int8_t delta_timestamp = static_cast<int8_t>(timestamp - prev_frame.timestamp);
-    packed_data.push_back(static_cast<uint8_t>(delta_timestamp));
+    writer.writeU8(static_cast<uint8_t>(delta_timestamp));
 
     // Encode origin components with full or delta size based on threshold
     for (int i = 0; i < 3; ++i) {
         if (origin_changed[i]) {
-            packed_data.push_back(static_cast<uint8_t>((origin_deltas[i] >> 8) & 0xFF)); // High byte of full value
-            packed_data.push_back(static_cast<uint8_t>(origin_deltas[i] & 0xFF));         // Low byte of full value
+            writer.writeU8(static_cast<uint8_t>((origin_deltas[i] >> 8) & 0xFF)); // High byte of full value
+            writer.writeU8(static_cast<uint8_t>(origin_deltas[i] & 0xFF));         // Low byte of full value
         }
         else {
-            packed_data.push_back(static_cast<int8_t>(origin_deltas[i])); // Delta encoded in 1 byte
+            writer.writeU8(static_cast<int8_t>(origin_deltas[i])); // Delta encoded in 1 byte
         }
     }
 
     // Encode angle components with full or delta size based on threshold
     for (int i = 0; i < 2; ++i) {
         if (angle_changed[i]) {
-            packed_data.push_back(static_cast<uint8_t>((angle_deltas[i] >> 8) & 0xFF)); // High byte of full value
-            packed_data.push_back(static_cast<uint8_t>(angle_deltas[i] & 0xFF));         // Low byte of full value
+            writer.writeU8(static_cast<uint8_t>((angle_deltas[i] >> 8) & 0xFF)); // High byte of full value
+            writer.writeU8(static_cast<uint8_t>(angle_deltas[i] & 0xFF));         // Low byte of full value
         }
         else {
-            packed_data.push_back(static_cast<uint8_t>(angle_deltas[i])); // Delta encoded in 1 byte
+            writer.writeU8(static_cast<uint8_t>(angle_deltas[i])); // Delta encoded in 1 byte
         }
     }
 
     // Encode speed with full or delta size
     int speed_delta = speed - prev_frame.speed;
     if (speed_changed) {
-        packed_data.push_back(static_cast<uint8_t>((speed_delta >> 8) & 0xFF)); // High byte of full value
-        packed_data.push_back(static_cast<uint8_t>(speed_delta & 0xFF));        // Low byte of full value
+        writer.writeU8(static_cast<uint8_t>((speed_delta >> 8) & 0xFF)); // High byte of full value
+        writer.writeU8(static_cast<uint8_t>(speed_delta & 0xFF));        // Low byte of full value
     }
     else {
-        packed_data.push_back(static_cast<uint8_t>(speed_delta)); // Delta encoded in 1 byte
+        writer.writeU8(static_cast<uint8_t>(speed_delta)); // Delta encoded in 1 byte
     }
 
     // Encode keys if changed
     if (keys_changed) {
-        packed_data.push_back(static_cast<uint8_t>(convertKeys(keys)));
+        writer.writeU8(static_cast<uint8_t>(convertKeys(keys)));
     }
 
     // Encode fps if changed
     if (fps_changed) {
-        packed_data.push_back(static_cast<uint8_t>(fps));
+        writer.writeU8(static_cast<uint8_t>(fps));
     }
 
     // Encode strafes if changed
     if (strafes_changed) {
-        packed_data.push_back(static_cast<uint8_t>(strafes));
+        writer.writeU8(static_cast<uint8_t>(strafes));
     }
 
     // Encode sync if changed
     if (sync_changed) {
-        packed_data.push_back(static_cast<uint8_t>(sync));
+        writer.writeU8(static_cast<uint8_t>(sync));
     }
+}
+
+std::vector<uint8_t> FrameData::encode()
+{
+    ByteWriter writer;
+    writer.reserve(MAX_FRAME_BYTE_SIZE);
+    encode(writer);
+    return writer.getBuffer();
+}
 
-    return packed_data;
+std::vector<uint8_t> FrameData::encode_delta(FrameData prev_frame)
+{
+    ByteWriter writer;
+    writer.reserve(MAX_FRAME_BYTE_SIZE);
+    encode_delta(writer, prev_frame);
+    return writer.getBuffer();
 }
 
 int FrameData::decode(const std::vector<uint8_t>& packed_data, FrameData* prev_frame) {
+    return decode(packed_data.data(), prev_frame);
+}
+
+int FrameData::decode(const uint8_t* packed_data, const FrameData* prev_frame) {
     size_t offset = 0;
 
     // Decode flags (3 bytes = 24 bits)
@@ -344,3 +357,213 @@ int FrameData::decode(const std::vector<uint8_t>& packed_data, FrameData* prev_f
     return offset;
 }
 
+int FrameData::frameSize(const uint8_t* packed_data, bool first_frame) {
+    // The first frame is always stored with full values
+    if (first_frame) {
+        return FRAME_FLAGS_BYTE_SIZE + 1 + 3 * ORIGIN_BYTE_SIZE + 2 * ANGLE_BYTE_SIZE + SPEED_BYTE_SIZE
+            + KEYS_BYTE_SIZE + FPS_BYTE_SIZE + STRAFES_BYTE_SIZE + SYNC_BYTE_SIZE;
+    }
+
+    uint32_t flags = (packed_data[0] << 16) | (packed_data[1] << 8) | packed_data[2];
+    if (flags & (1 << 0)) // RLE
+        return FRAME_FLAGS_BYTE_SIZE;
+
+    int size = FRAME_FLAGS_BYTE_SIZE + 1; // flags and timestamp delta
+
+    for (int i = 0; i < 3; ++i)
+        size += (flags & (1 << (i + 1))) ? ORIGIN_BYTE_SIZE : ORIGIN_BYTE_SIZE_DELTA;
+    for (int i = 0; i < 2; ++i)
+        size += (flags & (1 << (i + 4))) ? ANGLE_BYTE_SIZE : ANGLE_BYTE_SIZE_DELTA;
+    size += (flags & (1 << 6)) ? SPEED_BYTE_SIZE : SPEED_BYTE_SIZE_DELTA;
+
+    if (flags & (1 << 7)) size += KEYS_BYTE_SIZE;
+    if (flags & (1 << 8)) size += FPS_BYTE_SIZE;
+    if (flags & (1 << 9)) size += STRAFES_BYTE_SIZE;
+    if (flags & (1 << 10)) size += SYNC_BYTE_SIZE;
+
+    return size;
+}
+
+size_t FrameData::frameSize(const uint8_t* packed_data, size_t available, bool first_frame) {
+    if (available < FRAME_FLAGS_BYTE_SIZE)
+        return 0;
+
+    size_t size = static_cast<size_t>(frameSize(packed_data, first_frame));
+    return size <= available ? size : 0;
+}
+
+void FrameData::encode_record(ByteWriter& writer, const FrameData* prev_frame) const
+{
+    uint32_t flags = 0;
+    flags |= (grounded ? RECORD_GROUNDED : 0);
+    flags |= (gravity ? RECORD_GRAVITY : 0);
+
+    // Keyframes hold full values, only the state bits of the flags are used
+    if (prev_frame == nullptr) {
+        writer.writeVarint(flags);
+        writer.writeU8(static_cast<uint8_t>(timestamp));
+        for (int i = 0; i < 3; ++i)
+            writer.writeU16(static_cast<uint16_t>(origin[i]));
+        for (int i = 0; i < 2; ++i)
+            writer.writeU16(static_cast<uint16_t>(angles[i]));
+        writer.writeU16(static_cast<uint16_t>(speed));
+        writer.writeU8(static_cast<uint8_t>(convertKeys(keys)));
+        writer.writeU8(static_cast<uint8_t>(fps));
+        writer.writeU8(static_cast<uint8_t>(strafes));
+        writer.writeU8(static_cast<uint8_t>(sync));
+        return;
+    }
+
+    const int delta_limit = (1 << ((ORIGIN_BYTE_SIZE_DELTA * 8) - 1)) - 1;
+
+    int origin_deltas[3];
+    for (int i = 0; i < 3; ++i) {
+        origin_deltas[i] = origin[i] - prev_frame->origin[i];
+        if (std::abs(origin_deltas[i]) > delta_limit)
+            flags |= (RECORD_ORIGIN_X << i);
+    }
+
+    int angle_deltas[2];
+    for (int i = 0; i < 2; ++i) {
+        angle_deltas[i] = calc_angle_delta(angles[i], prev_frame->angles[i]);
+        if (std::abs(angle_deltas[i]) > delta_limit)
+            flags |= (RECORD_ANGLE_PITCH << i);
+    }
+
+    int speed_delta = speed - prev_frame->speed;
+    if (std::abs(speed_delta) > delta_limit)
+        flags |= RECORD_SPEED;
+
+    flags |= (keys != prev_frame->keys ? RECORD_KEYS : 0);
+    flags |= (fps != prev_frame->fps ? RECORD_FPS : 0);
+    flags |= (strafes != prev_frame->strafes ? RECORD_STRAFES : 0);
+    flags |= (sync != prev_frame->sync ? RECORD_SYNC : 0);
+
+    writer.writeVarint(flags);
+    writer.writeU8(static_cast<uint8_t>(timestamp - prev_frame->timestamp));
+
+    for (int i = 0; i < 3; ++i) {
+        if (flags & (RECORD_ORIGIN_X << i))
+            writer.writeU16(static_cast<uint16_t>(origin_deltas[i]));
+        else
+            writer.writeU8(static_cast<uint8_t>(origin_deltas[i]));
+    }
+
+    for (int i = 0; i < 2; ++i) {
+        if (flags & (RECORD_ANGLE_PITCH << i))
+            writer.writeU16(static_cast<uint16_t>(angle_deltas[i]));
+        else
+            writer.writeU8(static_cast<uint8_t>(angle_deltas[i]));
+    }
+
+    if (flags & RECORD_SPEED)
+        writer.writeU16(static_cast<uint16_t>(speed_delta));
+    else
+        writer.writeU8(static_cast<uint8_t>(speed_delta));
+
+    if (flags & RECORD_KEYS)
+        writer.writeU8(static_cast<uint8_t>(convertKeys(keys)));
+    if (flags & RECORD_FPS)
+        writer.writeU8(static_cast<uint8_t>(fps));
+    if (flags & RECORD_STRAFES)
+        writer.writeU8(static_cast<uint8_t>(strafes));
+    if (flags & RECORD_SYNC)
+        writer.writeU8(static_cast<uint8_t>(sync));
+}
+
+void FrameData::encode_repeat(ByteWriter& writer, uint32_t count)
+{
+    writer.writeVarint(RECORD_REPEAT);
+    writer.writeVarint(count);
+}
+
+int FrameData::decode_record(const uint8_t* packed_data, const FrameData* prev_frame, uint32_t& frames)
+{
+    size_t offset = 0;
+    uint32_t flags = readVarint(packed_data, offset);
+    frames = 1;
+
+    auto read_full = [packed_data, &offset]() {
+        int value = static_cast<int16_t>((packed_data[offset] << 8) | packed_data[offset + 1]);
+        offset += 2;
+        return value;
+    };
+    auto read_delta = [packed_data, &offset]() {
+        return static_cast<int>(static_cast<int8_t>(packed_data[offset++]));
+    };
+
+    // Keyframes never repeat, the flag is ignored so a damaged record can't refer to a missing frame
+    if (prev_frame == nullptr) {
+        timestamp = packed_data[offset++];
+        for (int i = 0; i < 3; ++i)
+            origin[i] = read_full();
+        for (int i = 0; i < 2; ++i)
+            angles[i] = read_full();
+        speed = read_full();
+        keys = decompactKeys(packed_data[offset++]);
+        fps = packed_data[offset++];
+        strafes = packed_data[offset++];
+        sync = packed_data[offset++];
+        grounded = flags & RECORD_GROUNDED;
+        gravity = flags & RECORD_GRAVITY;
+        return static_cast<int>(offset);
+    }
+
+    if (flags & RECORD_REPEAT) {
+        *this = *prev_frame;
+        frames = readVarint(packed_data, offset);
+        return static_cast<int>(offset);
+    }
+
+    timestamp = (prev_frame->timestamp + read_delta()) & 0xFF;
+
+    for (int i = 0; i < 3; ++i)
+        origin[i] = prev_frame->origin[i] + ((flags & (RECORD_ORIGIN_X << i)) ? read_full() : read_delta());
+
+    for (int i = 0; i < 2; ++i)
+        angles[i] = clamp_angle(prev_frame->angles[i] + ((flags & (RECORD_ANGLE_PITCH << i)) ? read_full() : read_delta()));
+
+    speed = prev_frame->speed + ((flags & RECORD_SPEED) ? read_full() : read_delta());
+
+    keys = (flags & RECORD_KEYS) ? decompactKeys(packed_data[offset++]) : prev_frame->keys;
+    fps = (flags & RECORD_FPS) ? packed_data[offset++] : prev_frame->fps;
+    strafes = (flags & RECORD_STRAFES) ? packed_data[offset++] : prev_frame->strafes;
+    sync = (flags & RECORD_SYNC) ? packed_data[offset++] : prev_frame->sync;
+
+    grounded = flags & RECORD_GROUNDED;
+    gravity = flags & RECORD_GRAVITY;
+
+    return static_cast<int>(offset);
+}
+
+size_t FrameData::recordSize(const uint8_t* packed_data, size_t available, bool keyframe)
+{
+    size_t size = varintSize(packed_data, available);
+    if (size == 0)
+        return 0;
+
+    size_t offset = 0;
+    uint32_t flags = readVarint(packed_data, offset);
+    if (flags & ~RECORD_FLAGS_MASK)
+        return 0;
+
+    if (keyframe) {
+        size += 1 + 3 * ORIGIN_BYTE_SIZE + 2 * ANGLE_BYTE_SIZE + SPEED_BYTE_SIZE
+            + KEYS_BYTE_SIZE + FPS_BYTE_SIZE + STRAFES_BYTE_SIZE + SYNC_BYTE_SIZE;
+        return size <= available ? size : 0;
+    }
+
+    // The repeat count is the only other varint
+    if (flags & RECORD_REPEAT) {
+        size_t count_size = varintSize(packed_data + size, available - size);
+        return count_size ? size + count_size : 0;
+    }
+
+    // Every flagged field adds one byte: a full delta instead of a one byte delta, or a changed byte field
+    const uint32_t wide_fields = RECORD_ORIGIN_X | RECORD_ORIGIN_Y | RECORD_ORIGIN_Z | RECORD_ANGLE_PITCH | RECORD_ANGLE_YAW | RECORD_SPEED;
+    const uint32_t byte_fields = RECORD_KEYS | RECORD_FPS | RECORD_STRAFES | RECORD_SYNC;
+    size += 1 + 3 * ORIGIN_BYTE_SIZE_DELTA + 2 * ANGLE_BYTE_SIZE_DELTA + SPEED_BYTE_SIZE_DELTA;
+    size += std::bitset<32>(flags & (wide_fields | byte_fields)).count();
+
+    return size <= available ? size : 0;
+}
@@ -0,0 +1,269 @@
+#include "MappedReplay.h"
+
+#include <iostream>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedReplay::~MappedReplay()
+{
+#ifdef _WIN32
+    if (data != nullptr)
+        UnmapViewOfFile(data);
+    if (mapping_handle != nullptr)
+        CloseHandle(mapping_handle);
+    if (file_handle != nullptr)
+        CloseHandle(file_handle);
+#else
+    if (data != nullptr)
+        munmap(const_cast<uint8_t*>(data), length);
+#endif
+}
+
+std::shared_ptr<MappedReplay> MappedReplay::open(const std::string& input_filename, DecodeError& error)
+{
+    std::shared_ptr<MappedReplay> replay(new MappedReplay());
+    if (!replay->map(input_filename)) {
+        error = { DECODE_UNREADABLE, 0 };
+        return nullptr;
+    }
+
+    if (replay->length < HEADER_BYTE_SIZE) {
+        std::cerr << "Replay file is too small: " << input_filename << std::endl;
+        error = { DECODE_TRUNCATED, replay->length };
+        return nullptr;
+    }
+
+    replay->header = Replay::decodeHeader(replay->data);
+    replay->frames_offset = HEADER_BYTE_SIZE;
+
+    // The frames are residuals until the reference is added back to all of them
+    if (replay->header.version & REPLAY_FLAG_REFERENCE) {
+        std::cerr << "Reference replays can't be mapped: " << input_filename << std::endl;
+        error = { DECODE_MISSING_REFERENCE, 0 };
+        return nullptr;
+    }
+
+    // The whole mapping is checked once, frames decoded later can trust it
+    size_t content_length;
+    if (!Replay::verifyChecksums(replay->data, replay->length, content_length, error)) {
+        std::cerr << "Damaged replay " << input_filename << ": " << error.message() << std::endl;
+        return nullptr;
+    }
+
+    replay->stream = replay->data;
+    replay->stream_length = content_length;
+    if (replay->header.version & REPLAY_FLAG_ENTROPY) {
+        if (!Replay::decodeEntropy(replay->data, content_length, replay->image)) {
+            std::cerr << "Invalid entropy coded data: " << input_filename << std::endl;
+            error = { DECODE_INVALID_DATA, HEADER_BYTE_SIZE };
+            return nullptr;
+        }
+        replay->stream = replay->image.data();
+        replay->stream_length = replay->image.size();
+    }
+
+    if (replay->header.version & REPLAY_FLAG_COLUMNAR) {
+        if (!ColumnarFormat::decode(replay->stream + HEADER_BYTE_SIZE, replay->stream_length - HEADER_BYTE_SIZE, replay->columns)) {
+            std::cerr << "Invalid columnar data: " << input_filename << std::endl;
+            error = { DECODE_INVALID_DATA, HEADER_BYTE_SIZE };
+            return nullptr;
+        }
+        replay->columnar = true;
+        replay->frame_count = replay->columns.size();
+        return replay;
+    }
+
+    if (!Replay::decodeKeyframeIndex(replay->stream, replay->stream_length, replay->header.version, replay->index)) {
+        std::cerr << "Invalid keyframe index: " << input_filename << std::endl;
+        error = { DECODE_INVALID_TRAILER, content_length };
+        return nullptr;
+    }
+
+    replay->records = replayRevision(replay->header.version) >= REPLAY_VERSION_RUNS;
+
+    if (replay->index.interval > 0) {
+        replay->frame_count = replay->index.frame_count;
+    }
+    else {
+        // Count the frames from their flags only, a truncated last frame is dropped
+        size_t offset = replay->frames_offset;
+        while (offset < replay->index.frames_end) {
+            size_t frame_size = FrameData::frameSize(replay->stream + offset, replay->index.frames_end - offset, replay->frame_count == 0);
+            if (frame_size == 0)
+                break;
+
+            offset += frame_size;
+            replay->frame_count++;
+        }
+    }
+
+    replay->rewind();
+
+    return replay;
+}
+
+bool MappedReplay::map(const std::string& input_filename)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(input_filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        std::cerr << "Error opening input file: " << input_filename << std::endl;
+        return false;
+    }
+    file_handle = file;
+
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        std::cerr << "Error reading input file size: " << input_filename << std::endl;
+        return false;
+    }
+    length = static_cast<size_t>(file_size.QuadPart);
+
+    mapping_handle = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle == nullptr) {
+        std::cerr << "Error mapping input file: " << input_filename << std::endl;
+        return false;
+    }
+
+    data = static_cast<const uint8_t*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (data == nullptr) {
+        std::cerr << "Error mapping input file: " << input_filename << std::endl;
+        return false;
+    }
+#else
+    int fd = ::open(input_filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening input file: " << input_filename << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        std::cerr << "Error reading input file size: " << input_filename << std::endl;
+        close(fd);
+        return false;
+    }
+    length = static_cast<size_t>(st.st_size);
+
+    void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps its own reference to the file
+
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error mapping input file: " << input_filename << std::endl;
+        return false;
+    }
+    data = static_cast<const uint8_t*>(mapping);
+#endif
+
+    return true;
+}
+
+void MappedReplay::rewind()
+{
+    current = FrameData();
+    current_index = 0;
+    next_offset = frames_offset;
+    has_current = false;
+    has_previous = false;
+    run_remaining = 0;
+}
+
+size_t MappedReplay::frameSize(bool keyframe) const
+{
+    size_t available = next_offset < index.frames_end ? index.frames_end - next_offset : 0;
+    return records
+        ? FrameData::recordSize(stream + next_offset, available, keyframe)
+        : FrameData::frameSize(stream + next_offset, available, keyframe);
+}
+
+void MappedReplay::seekKeyframe(size_t keyframe)
+{
+    next_offset = index.offsets[keyframe];
+    current_index = keyframe * index.interval;
+    run_remaining = 0;
+    has_previous = false;
+
+    // A damaged keyframe repeats the last good frame
+    if (frameSize(true) == 0) {
+        has_current = true;
+        return;
+    }
+
+    if (records) {
+        uint32_t frames;
+        next_offset += current.decode_record(stream + next_offset, nullptr, frames);
+    }
+    else {
+        next_offset += current.decode(stream + next_offset, nullptr);
+    }
+
+    has_current = true;
+}
+
+void MappedReplay::step()
+{
+    previous = current;
+    has_previous = has_current;
+
+    // Inside a repeat run the frame doesn't change
+    if (run_remaining > 0) {
+        run_remaining--;
+        current_index++;
+        return;
+    }
+
+    // Mapped files are checked frame by frame as they are read, a damaged frame repeats the last good one
+    if (frameSize(!has_current) == 0) {
+        current_index = has_current ? current_index + 1 : 0;
+        has_current = true;
+        return;
+    }
+
+    FrameData next;
+    if (records) {
+        uint32_t frames;
+        next_offset += next.decode_record(stream + next_offset, has_current ? &current : nullptr, frames);
+        run_remaining = frames > 0 ? frames - 1 : 0;
+    }
+    else {
+        next_offset += next.decode(stream + next_offset, has_current ? &current : nullptr);
+    }
+
+    current_index = has_current ? current_index + 1 : 0;
+    current = next;
+    has_current = true;
+}
+
+FrameData MappedReplay::getFrame(size_t frame)
+{
+    if (frame >= frame_count)
+        throw std::out_of_range("Frame index out of range");
+
+    if (columnar)
+        return columns.at(frame);
+
+    if (has_previous && frame + 1 == current_index)
+        return previous;
+
+    if (index.interval > 0) {
+        // Jump to the keyframe when it is closer than the cursor
+        size_t keyframe = frame / index.interval;
+        if (!has_current || frame < current_index || keyframe * index.interval > current_index)
+            seekKeyframe(keyframe);
+    }
+    else if (has_current && frame < current_index) {
+        rewind();
+    }
+
+    while (!has_current || current_index < frame)
+        step();
+
+    return current;
+}
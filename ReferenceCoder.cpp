@@ -0,0 +1,208 @@
+#include "ReferenceCoder.h"
+
+#include <algorithm>
+
+namespace {
+
+uint32_t zigzag(int32_t value)
+{
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+}
+
+int32_t unzigzag(uint32_t value)
+{
+    return static_cast<int32_t>(value >> 1) ^ -static_cast<int32_t>(value & 1);
+}
+
+bool readVarint(const uint8_t* data, size_t size, size_t& offset, uint32_t& value)
+{
+    value = 0;
+    for (int shift = 0;; shift += 7) {
+        if (offset >= size || shift > 28)
+            return false;
+        uint8_t byte = data[offset++];
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+}
+
+// Shortest turn from the reference angle, except that half a turn keeps the side it was recorded with
+int angleResidual(int angle, int reference)
+{
+    int residual = FrameData::calc_angle_delta(angle, reference);
+    return residual + angle - FrameData::clamp_angle(reference + residual);
+}
+
+// Reference frame in [first, last) with the origin nearest to the origin of frame index moved by offset.
+// Ties go to the frame closest to expected, so standing still on both runs keeps them in step.
+size_t nearestFrame(const ReplayColumns& frames, size_t index, const int offset[3], const ReplayColumns& reference, size_t first, size_t last, size_t expected)
+{
+    const FrameChunk& chunk = frames.getChunk(index / FRAMES_PER_CHUNK);
+    size_t i = index % FRAMES_PER_CHUNK;
+
+    size_t nearest = first;
+    int64_t nearest_distance = INT64_MAX;
+    for (size_t j = first; j < last; j++) {
+        const FrameChunk& reference_chunk = reference.getChunk(j / FRAMES_PER_CHUNK);
+        size_t k = j % FRAMES_PER_CHUNK;
+
+        int64_t distance = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            int64_t delta = chunk.origin[axis][i] - offset[axis] - reference_chunk.origin[axis][k];
+            distance += delta * delta;
+        }
+
+        auto gap = [expected](size_t frame) { return frame > expected ? frame - expected : expected - frame; };
+        if (distance < nearest_distance || (distance == nearest_distance && gap(j) < gap(nearest))) {
+            nearest = j;
+            nearest_distance = distance;
+        }
+    }
+
+    return nearest;
+}
+
+}
+
+uint64_t ReferenceCoder::contentHash(const ReplayColumns& frames)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](uint8_t byte) {
+        hash ^= byte;
+        hash *= 1099511628211ull;
+    };
+    auto mix_bytes = [&mix](const uint8_t* bytes, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            mix(bytes[i]);
+    };
+    // Little endian whatever the machine, so every server agrees on the hash
+    auto mix_word = [&mix](int16_t value) {
+        uint16_t word = static_cast<uint16_t>(value);
+        mix(static_cast<uint8_t>(word));
+        mix(static_cast<uint8_t>(word >> 8));
+    };
+    auto mix_words = [&mix_word](const int16_t* words, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            mix_word(words[i]);
+    };
+    // Frame records may turn half a turn to the other side, both sides hash the same
+    auto mix_angles = [&mix_word](const int16_t* angles, size_t count) {
+        for (size_t i = 0; i < count; i++)
+            mix_word(angles[i] == -900 ? 900 : angles[i]);
+    };
+
+    uint32_t count = static_cast<uint32_t>(frames.size());
+    for (int shift = 0; shift < 32; shift += 8)
+        mix(static_cast<uint8_t>(count >> shift));
+
+    for (size_t chunk = 0; chunk < frames.chunkCount(); chunk++) {
+        const FrameChunk& columns = frames.getChunk(chunk);
+        size_t chunk_frames = frames.chunkFrames(chunk);
+
+        mix_bytes(columns.timestamp, chunk_frames);
+        for (int axis = 0; axis < 3; axis++)
+            mix_words(columns.origin[axis], chunk_frames);
+        for (int axis = 0; axis < 2; axis++)
+            mix_angles(columns.angles[axis], chunk_frames);
+        mix_words(columns.speed, chunk_frames);
+        mix_bytes(columns.fps, chunk_frames);
+        mix_bytes(columns.keys, chunk_frames);
+        mix_bytes(columns.strafes, chunk_frames);
+        mix_bytes(columns.sync, chunk_frames);
+        mix_bytes(columns.state, chunk_frames);
+    }
+
+    return hash;
+}
+
+void ReferenceCoder::encode(const ReplayColumns& frames, const ReplayColumns& reference, ReplayColumns& residuals, ByteWriter& alignment)
+{
+    residuals = frames;
+    if (frames.empty() || reference.empty())
+        return;
+
+    int64_t match = -1;
+    int32_t run_step = 0;
+    uint32_t run_length = 0;
+    int offset[3] = { 0, 0, 0 };
+
+    for (size_t index = 0; index < frames.size(); index++) {
+        // The start of the run may be anywhere in the reference, later frames stay close to the previous match.
+        // They are matched after removing the offset of the previous frame, which keeps the residuals
+        // steady on a parallel line instead of jumping between the reference frames beside it.
+        size_t nearest;
+        if (match < 0) {
+            nearest = nearestFrame(frames, index, offset, reference, 0, reference.size(), 0);
+        }
+        else {
+            size_t previous = static_cast<size_t>(match);
+            size_t first = previous > REFERENCE_SEARCH_WINDOW ? previous - REFERENCE_SEARCH_WINDOW : 0;
+            size_t last = std::min<size_t>(reference.size(), previous + REFERENCE_SEARCH_WINDOW + 1);
+            nearest = nearestFrame(frames, index, offset, reference, first, last, previous + 1);
+        }
+
+        int32_t step = static_cast<int32_t>(static_cast<int64_t>(nearest) - match);
+        match = static_cast<int64_t>(nearest);
+
+        if (run_length > 0 && step == run_step) {
+            run_length++;
+        }
+        else {
+            if (run_length > 0) {
+                alignment.writeVarint(zigzag(run_step));
+                alignment.writeVarint(run_length);
+            }
+            run_step = step;
+            run_length = 1;
+        }
+
+        FrameChunk& chunk = residuals.getChunk(index / FRAMES_PER_CHUNK);
+        const FrameChunk& reference_chunk = reference.getChunk(nearest / FRAMES_PER_CHUNK);
+        size_t i = index % FRAMES_PER_CHUNK;
+        size_t k = nearest % FRAMES_PER_CHUNK;
+
+        for (int axis = 0; axis < 3; axis++) {
+            offset[axis] = chunk.origin[axis][i] - reference_chunk.origin[axis][k];
+            chunk.origin[axis][i] = static_cast<int16_t>(offset[axis]);
+        }
+        for (int axis = 0; axis < 2; axis++)
+            chunk.angles[axis][i] = static_cast<int16_t>(angleResidual(chunk.angles[axis][i], reference_chunk.angles[axis][k]));
+    }
+
+    alignment.writeVarint(zigzag(run_step));
+    alignment.writeVarint(run_length);
+}
+
+bool ReferenceCoder::decode(const uint8_t* alignment, size_t size, const ReplayColumns& reference, ReplayColumns& frames)
+{
+    size_t offset = 0;
+    size_t index = 0;
+    int64_t match = -1;
+
+    while (index < frames.size()) {
+        uint32_t step, run_length;
+        if (!readVarint(alignment, size, offset, step) || !readVarint(alignment, size, offset, run_length) ||
+            run_length == 0 || run_length > frames.size() - index)
+            return false;
+
+        int32_t delta = unzigzag(step);
+        for (uint32_t run = 0; run < run_length; run++, index++) {
+            match += delta;
+            if (match < 0 || static_cast<size_t>(match) >= reference.size())
+                return false;
+
+            FrameChunk& chunk = frames.getChunk(index / FRAMES_PER_CHUNK);
+            const FrameChunk& reference_chunk = reference.getChunk(static_cast<size_t>(match) / FRAMES_PER_CHUNK);
+            size_t i = index % FRAMES_PER_CHUNK;
+            size_t k = static_cast<size_t>(match) % FRAMES_PER_CHUNK;
+
+            for (int axis = 0; axis < 3; axis++)
+                chunk.origin[axis][i] = static_cast<int16_t>(chunk.origin[axis][i] + reference_chunk.origin[axis][k]);
+            for (int axis = 0; axis < 2; axis++)
+                chunk.angles[axis][i] = static_cast<int16_t>(FrameData::clamp_angle(chunk.angles[axis][i] + reference_chunk.angles[axis][k]));
+        }
+    }
+
+    return offset == size;
+}
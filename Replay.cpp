@@ -1,87 +1,670 @@
-#include "amxxmodule.h"
-
 #include "Replay.h"
+#include "MappedReplay.h"
+#include "EntropyCoder.h"
+#include "ReferenceCoder.h"
+#include "ReplayCursor.h"
+#include "Simd.h"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <string>
-#include "utils.h"
+#include <cstdio>
+#include <cstring>
+#include <sys/types.h>
+#include <sys/stat.h>
 
-void Replay::encode(const std::string& output_filename)
-{
-    std::ofstream output_file(output_filename, std::ios::binary);
-    if (!output_file.is_open()) {
-        std::cerr << "Error opening output file: " << output_filename << std::endl;
-        return;
-    }
-    std::vector<uint8_t> encoded_data = encodeHeader(header);
-    output_file.write(reinterpret_cast<const char*>(encoded_data.data()), encoded_data.size());
+#ifdef _WIN32
+#include <windows.h>
+#endif
 
+bool Replay::encode(const std::string& output_filename, uint16_t format_flags, const Replay* reference) const
+{
     if (frames.size() < 1)
     {
         std::cerr<<"No Frames in replay!";
+        return false;
+    }
+
+    // The whole file is encoded into one buffer and written with a single call
+    ByteWriter writer;
+    encode(writer, format_flags, reference);
+
+    return writeFile(output_filename, writer.data(), writer.size());
+}
+
+void Replay::encode(ByteWriter& writer, uint16_t format_flags, const Replay* reference) const
+{
+    // Residuals need the frames of the reference in memory, a mapped or empty one encodes the frames as they are
+    if (reference != nullptr && (reference->isMapped() || reference->frames.empty())) {
+        std::cerr << "Reference replay is not decoded, encoding without it" << std::endl;
+        reference = nullptr;
+    }
+
+    format_flags &= ~REPLAY_FLAG_REFERENCE;
+    if (reference != nullptr)
+        format_flags |= REPLAY_FLAG_REFERENCE;
+
+    // Always written in the current format
+    Header out_header = header;
+    out_header.version = REPLAY_VERSION | format_flags;
+
+    size_t start = writer.size();
+    if (!(format_flags & REPLAY_FLAG_ENTROPY)) {
+        encodeHeader(out_header, writer);
+        encodeBody(writer, start, format_flags, reference);
+        encodeChecksums(writer, start);
+        return;
+    }
+
+    // The plain image is built first so the keyframe offsets match the image rebuilt by decodeEntropy
+    ByteWriter image;
+    encodeHeader(out_header, image);
+    encodeBody(image, 0, format_flags, reference);
+
+    size_t body_size = image.size() - HEADER_BYTE_SIZE;
+    writer.reserve(writer.size() + HEADER_BYTE_SIZE + ENTROPY_SIZE_BYTE_SIZE + body_size / 2);
+    writer.writeBytes(image.data(), HEADER_BYTE_SIZE);
+    writer.writeU32(static_cast<uint32_t>(body_size));
+    EntropyCoder::encode(image.data() + HEADER_BYTE_SIZE, body_size, writer);
+
+    // The stored bytes are checked, so damage is found before the entropy decoder runs
+    encodeChecksums(writer, start);
+}
+
+void Replay::encodeChecksums(ByteWriter& writer, size_t start)
+{
+    size_t content_size = writer.size() - start;
+    size_t block_count = (content_size + CHECKSUM_BLOCK_BYTE_SIZE - 1) / CHECKSUM_BLOCK_BYTE_SIZE;
+
+    // Computed first, writing the trailer may move the buffer
+    std::vector<uint32_t> checksums(block_count);
+    for (size_t block = 0; block < block_count; block++) {
+        size_t offset = block * CHECKSUM_BLOCK_BYTE_SIZE;
+        size_t length = std::min<size_t>(CHECKSUM_BLOCK_BYTE_SIZE, content_size - offset);
+        checksums[block] = Simd::crc32c(writer.data() + start + offset, length);
+    }
+
+    for (uint32_t checksum : checksums)
+        writer.writeU32(checksum);
+
+    writer.writeU32(CHECKSUM_BLOCK_BYTE_SIZE);
+    writer.writeU32(static_cast<uint32_t>(block_count));
+    writer.writeU32(CHECKSUM_TRAILER_MAGIC);
+}
+
+void Replay::encodeBody(ByteWriter& writer, size_t start, uint16_t format_flags, const Replay* reference) const
+{
+    // The residuals are encoded like any frames, the alignment runs and the reference trailer follow them
+    if (reference != nullptr) {
+        Replay residuals;
+        ByteWriter alignment;
+        ReferenceCoder::encode(frames, reference->frames, residuals.frames, alignment);
+        residuals.encodeBody(writer, start, format_flags, nullptr);
+
+        writer.writeBytes(alignment.data(), alignment.size());
+        writer.writeU64(reference->contentHash());
+        writer.writeU32(static_cast<uint32_t>(alignment.size()));
+        writer.writeU32(REFERENCE_TRAILER_MAGIC);
         return;
     }
-    encoded_data = frames[0].encode();
-    output_file.write(reinterpret_cast<const char*>(encoded_data.data()), encoded_data.size());
-    for (size_t i = 1; i < frames.size(); i++)
+
+    if (format_flags & REPLAY_FLAG_COLUMNAR)
+        ColumnarFormat::encode(frames, writer);
+    else
+        encodeFrames(writer, start);
+}
+
+void Replay::encodeFrames(ByteWriter& writer, size_t start) const
+{
+    size_t keyframe_count = (frames.size() + KEYFRAME_INTERVAL - 1) / KEYFRAME_INTERVAL;
+    writer.reserve(writer.size() + frames.size() * MAX_RECORD_BYTE_SIZE +
+        keyframe_count * KEYFRAME_OFFSET_BYTE_SIZE + KEYFRAME_TRAILER_BYTE_SIZE);
+
+    std::vector<uint32_t> keyframe_offsets;
+    keyframe_offsets.reserve(keyframe_count);
+
+    FrameData prev_frame;
+    for (size_t i = 0; i < frames.size(); i++)
     {
-        encoded_data = frames[i].encode_delta(frames[i - 1]);
+        FrameData frame = frames.at(i);
+
+        // Every KEYFRAME_INTERVAL frames is stored with full values so playback can seek to it
+        if (i % KEYFRAME_INTERVAL == 0) {
+            keyframe_offsets.push_back(static_cast<uint32_t>(writer.size() - start));
+            frame.encode_record(writer, nullptr);
+            prev_frame = frame;
+            continue;
+        }
+
+        // Identical frames collapse into one repeat record, runs stop at the next keyframe
+        if (frame == prev_frame) {
+            size_t run_end = i + 1;
+            while (run_end < frames.size() && run_end % KEYFRAME_INTERVAL != 0 && frames.at(run_end) == prev_frame)
+                run_end++;
+
+            FrameData::encode_repeat(writer, static_cast<uint32_t>(run_end - i));
+            i = run_end - 1;
+            continue;
+        }
+
+        frame.encode_record(writer, &prev_frame);
+        prev_frame = frame;
+    }
+
+    // Keyframe index followed by the fixed size trailer
+    for (uint32_t keyframe_offset : keyframe_offsets)
+        writer.writeU32(keyframe_offset);
+
+    writer.writeU32(static_cast<uint32_t>(frames.size()));
+    writer.writeU16(KEYFRAME_INTERVAL);
+    writer.writeU32(static_cast<uint32_t>(keyframe_offsets.size()));
+    writer.writeU32(KEYFRAME_TRAILER_MAGIC);
+}
+
+bool Replay::writeFile(const std::string& output_filename, const uint8_t* data, size_t size)
+{
+    // Write to a temporary file first so a crash never leaves a truncated replay behind
+    std::string temp_filename = output_filename + ".tmp";
+
+    std::ofstream output_file(temp_filename, std::ios::binary | std::ios::trunc);
+    if (!output_file.is_open()) {
+        std::cerr << "Error opening output file: " << temp_filename << std::endl;
+        return false;
+    }
+
+    output_file.write(reinterpret_cast<const char*>(data), size);
+
+    output_file.close();
+    if (output_file.fail()) {
+        std::cerr << "Error writing output file: " << temp_filename << std::endl;
+        std::remove(temp_filename.c_str());
+        return false;
+    }
+
+    // Atomically replace the previous replay
+#ifdef _WIN32
+    bool renamed = MoveFileExA(temp_filename.c_str(), output_filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool renamed = std::rename(temp_filename.c_str(), output_filename.c_str()) == 0;
+#endif
+    if (!renamed) {
+        std::cerr << "Error replacing output file: " << output_filename << std::endl;
+        std::remove(temp_filename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool Replay::fileInfo(const std::string& filename, uint64_t& size, int64_t& modified)
+{
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0)
+        return false;
+
+    size = static_cast<uint64_t>(st.st_size);
+    modified = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
 
-        output_file.write(reinterpret_cast<const char*>(encoded_data.data()), encoded_data.size());
+Replay Replay::decode(const std::string& input_filename, uint32_t stream_mask, const Replay* reference)
+{
+    std::vector<uint8_t> buffer;
+    if (!readFile(input_filename, buffer)) {
+        Replay replay = Replay();
+        replay.error.status = DECODE_UNREADABLE;
+        return replay;
     }
 
+    return decode(buffer.data(), buffer.size(), stream_mask, reference);
 }
 
-Replay Replay::decode(const std::string& input_filename)
+Replay Replay::decode(const uint8_t* data, size_t size, uint32_t stream_mask, const Replay* reference)
 {
     Replay replay;
 
-    std::ifstream input_file(input_filename, std::ios::binary);
+    if (size < HEADER_BYTE_SIZE) {
+        std::cerr << "Replay data is too small" << std::endl;
+        replay.error = { DECODE_TRUNCATED, size };
+        return replay;
+    }
+
+    replay.header = Replay::decodeHeader(data);
+
+    // Nothing is decoded from a damaged file, the trailer is dropped from the size
+    if (!verifyChecksums(data, size, size, replay.error)) {
+        std::cerr << "Damaged replay: " << replay.error.message() << std::endl;
+        return replay;
+    }
+
+    // Entropy coded replays are decoded back to the plain image first
+    std::vector<uint8_t> image;
+    if (replay.header.version & REPLAY_FLAG_ENTROPY) {
+        if (!decodeEntropy(data, size, image)) {
+            std::cerr << "Invalid entropy coded data" << std::endl;
+            replay.error = { DECODE_INVALID_DATA, HEADER_BYTE_SIZE };
+            return replay;
+        }
+        data = image.data();
+        size = image.size();
+    }
+
+    if (!(replay.header.version & REPLAY_FLAG_REFERENCE)) {
+        replay.decodeBody(data, size, stream_mask);
+        return replay;
+    }
+
+    // The frames end where the alignment runs start
+    size_t alignment;
+    size_t image_size = size;
+    if (!decodeReferenceTrailer(data, size, replay.reference_hash, alignment)) {
+        std::cerr << "Invalid reference trailer" << std::endl;
+        replay.error = { DECODE_INVALID_TRAILER, size };
+        return replay;
+    }
+
+    if (reference == nullptr || reference->contentHash() != replay.reference_hash) {
+        replay.error = { DECODE_MISSING_REFERENCE, alignment };
+        return replay;
+    }
+
+    // Every stream is decoded, the residuals of skipped streams would come back as the reference
+    replay.decodeBody(data, size, STREAM_ALL);
+    if (replay.error.status != DECODE_OK)
+        return replay;
+
+    size_t trailer = image_size - REFERENCE_TRAILER_BYTE_SIZE;
+    if (!ReferenceCoder::decode(data + alignment, trailer - alignment, reference->frames, replay.frames)) {
+        std::cerr << "Invalid reference alignment" << std::endl;
+        replay.frames.clear();
+        replay.error = { DECODE_INVALID_DATA, alignment };
+    }
+
+    return replay;
+}
+
+void Replay::decodeBody(const uint8_t* data, size_t size, uint32_t stream_mask)
+{
+    size_t offset = HEADER_BYTE_SIZE;
+
+    if (header.version & REPLAY_FLAG_COLUMNAR) {
+        if (!ColumnarFormat::decode(data + offset, size - offset, frames, stream_mask)) {
+            std::cerr << "Invalid columnar data" << std::endl;
+            frames.clear();
+            error = { DECODE_INVALID_DATA, HEADER_BYTE_SIZE };
+        }
+        return;
+    }
+
+    KeyframeIndex index;
+    if (!decodeKeyframeIndex(data, size, header.version, index)) {
+        std::cerr << "Invalid keyframe index" << std::endl;
+        error = { DECODE_INVALID_TRAILER, size };
+        return;
+    }
+
+    if (index.frame_count > 0)
+        frames.reserve(index.frame_count);
+
+    // Frames are decoded in place, the previous frame is the last one decoded.
+    // Each frame gets one bounds check: away from the end no frame can be longer than what is left,
+    // near it the exact size is worked out from the flags before the frame is decoded.
+    bool records = replayRevision(header.version) >= REPLAY_VERSION_RUNS;
+    FrameData prev_frame;
+    while (offset < index.frames_end) {
+        // Keyframes are stored with full values
+        bool keyframe = frames.empty() || (index.interval > 0 && frames.size() % index.interval == 0);
+        size_t available = index.frames_end - offset;
+
+        FrameData current_frame;
+        if (!records) {
+            if (available < MAX_FRAME_BYTE_SIZE && FrameData::frameSize(data + offset, available, keyframe) == 0) {
+                error = { DECODE_TRUNCATED, offset };
+                break;
+            }
+
+            offset += current_frame.decode(data + offset, keyframe ? nullptr : &prev_frame);
+            addFrame(current_frame);
+            prev_frame = current_frame;
+            continue;
+        }
+
+        if (available < MAX_RECORD_READ_BYTE_SIZE && FrameData::recordSize(data + offset, available, keyframe) == 0) {
+            error = { DECODE_INVALID_DATA, offset };
+            break;
+        }
+
+        uint32_t repeat;
+        size_t record_offset = offset;
+        offset += current_frame.decode_record(data + offset, keyframe ? nullptr : &prev_frame, repeat);
+        if (repeat == 0 || frames.size() + repeat > index.frame_count) {
+            error = { DECODE_INVALID_DATA, record_offset };
+            break;
+        }
+
+        for (uint32_t i = 0; i < repeat; i++)
+            addFrame(current_frame);
+        prev_frame = current_frame;
+    }
+
+    if (error.status == DECODE_OK && index.interval > 0 && frames.size() != index.frame_count)
+        error = { DECODE_INVALID_TRAILER, index.frames_end };
+
+    // Nothing from a damaged frame stream is kept
+    if (error.status != DECODE_OK) {
+        std::cerr << "Damaged replay: " << error.message() << std::endl;
+        frames.clear();
+    }
+}
+
+bool Replay::readFile(const std::string& input_filename, std::vector<uint8_t>& buffer)
+{
+    std::ifstream input_file(input_filename, std::ios::binary | std::ios::ate);
     if (!input_file.is_open()) {
         std::cerr << "Error opening input file: " << input_filename << std::endl;
-        return replay;
+        return false;
     }
 
-    std::vector<uint8_t> buffer((std::istreambuf_iterator<char>(input_file)),
-        std::istreambuf_iterator<char>());
-    input_file.close();
+    // Read the whole file with a single call
+    buffer.resize(static_cast<size_t>(input_file.tellg()));
+    input_file.seekg(0, std::ios::beg);
+    input_file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+
+    return !input_file.fail();
+}
 
-    size_t offset = 133;
+bool Replay::verifyChecksums(const uint8_t* data, size_t size, size_t& content_size, DecodeError& error)
+{
+    content_size = size;
+    if (size < HEADER_BYTE_SIZE) {
+        error = { DECODE_TRUNCATED, size };
+        return false;
+    }
 
-    std::vector<uint8_t> header_data(buffer.begin(), buffer.begin() + offset);
-    replay.header = Replay::decodeHeader(header_data);
+    FixedHeader header;
+    parseHeader(data, header);
+    if (replayRevision(header.version) < REPLAY_VERSION_CHECKSUM)
+        return true;
 
-    FrameData* prev_frame = nullptr;
+    auto read_u32 = [data](size_t offset) {
+        return (static_cast<uint32_t>(data[offset]) << 24) | (static_cast<uint32_t>(data[offset + 1]) << 16) |
+            (static_cast<uint32_t>(data[offset + 2]) << 8) | static_cast<uint32_t>(data[offset + 3]);
+    };
 
-    while (offset < buffer.size()) {
-        // Create a vector for the current frame data starting from the current offset
-        std::vector<uint8_t> frame_data(buffer.begin() + offset, buffer.end());
+    // A truncated file loses its trailer first
+    if (size < HEADER_BYTE_SIZE + CHECKSUM_TRAILER_BYTE_SIZE) {
+        error = { DECODE_TRUNCATED, size };
+        return false;
+    }
 
-        // Decode the frame
-        int origin[3] = { 0, 0, 0 };
-        int angles[2] = { 0, 0 };
-        FrameData current_frame(0, origin, angles, 0, 0, 0, 0, 0, false, false);
+    size_t trailer = size - CHECKSUM_TRAILER_BYTE_SIZE;
+    uint32_t block_size = read_u32(trailer);
+    uint32_t block_count = read_u32(trailer + 4);
+    if (read_u32(trailer + 8) != CHECKSUM_TRAILER_MAGIC) {
+        error = { DECODE_TRUNCATED, size };
+        return false;
+    }
 
-        // Update offset with the number of bytes processed in the current frame
-        offset += current_frame.decode(frame_data, prev_frame);
+    // No body is larger than MAX_BODY_BYTE_SIZE, neither is a block. A body smaller than a block has one block.
+    if (block_size == 0 || block_size > MAX_BODY_BYTE_SIZE || block_count > trailer / CHECKSUM_BYTE_SIZE) {
+        error = { DECODE_INVALID_TRAILER, trailer };
+        return false;
+    }
 
-        replay.addFrame(current_frame);
+    // 64-bit so a forged block size can't wrap the count on 32-bit builds
+    size_t checksums = trailer - static_cast<size_t>(block_count) * CHECKSUM_BYTE_SIZE;
+    if (checksums < HEADER_BYTE_SIZE || (static_cast<uint64_t>(checksums) + block_size - 1) / block_size != block_count) {
+        error = { DECODE_INVALID_TRAILER, trailer };
+        return false;
+    }
 
-        // Update prev_frame to point to the current frame (for delta decoding)
-        if (prev_frame != nullptr) {
-            delete prev_frame;
+    // Blocks are checked in file order, the first damaged one is reported
+    for (uint32_t block = 0; block < block_count; block++) {
+        size_t offset = static_cast<size_t>(block) * block_size;
+        size_t length = std::min<size_t>(block_size, checksums - offset);
+        if (Simd::crc32c(data + offset, length) != read_u32(checksums + block * CHECKSUM_BYTE_SIZE)) {
+            error = { DECODE_CHECKSUM_MISMATCH, offset };
+            return false;
         }
-        prev_frame = new FrameData(current_frame);
     }
 
-    // Clean up
-    if (prev_frame != nullptr) {
-        delete prev_frame;
+    content_size = checksums;
+    return true;
+}
+
+std::string DecodeError::message() const
+{
+    const char* reason;
+    switch (status) {
+    case DECODE_OK: return "ok";
+    case DECODE_UNREADABLE: return "cannot read file";
+    case DECODE_MISSING_REFERENCE: return "missing reference replay";
+    case DECODE_TRUNCATED: reason = "truncated"; break;
+    case DECODE_INVALID_TRAILER: reason = "invalid trailer"; break;
+    case DECODE_CHECKSUM_MISMATCH: reason = "checksum mismatch"; break;
+    default: reason = "invalid data"; break;
+    }
+
+    return std::string(reason) + " at byte " + std::to_string(offset);
+}
+
+bool Replay::decodeEntropy(const uint8_t* data, size_t size, std::vector<uint8_t>& image)
+{
+    if (size < HEADER_BYTE_SIZE + ENTROPY_SIZE_BYTE_SIZE)
+        return false;
+
+    const uint8_t* body = data + HEADER_BYTE_SIZE;
+    uint32_t body_size = (static_cast<uint32_t>(body[0]) << 24) | (static_cast<uint32_t>(body[1]) << 16) |
+        (static_cast<uint32_t>(body[2]) << 8) | static_cast<uint32_t>(body[3]);
+    if (body_size > MAX_BODY_BYTE_SIZE)
+        return false;
+
+    image.clear();
+    image.reserve(HEADER_BYTE_SIZE + body_size);
+    image.insert(image.end(), data, data + HEADER_BYTE_SIZE);
+
+    return EntropyCoder::decode(body + ENTROPY_SIZE_BYTE_SIZE, size - HEADER_BYTE_SIZE - ENTROPY_SIZE_BYTE_SIZE, body_size, image);
+}
+
+bool Replay::decodeReferenceTrailer(const uint8_t* data, size_t& size, uint64_t& reference_hash, size_t& alignment)
+{
+    if (size < HEADER_BYTE_SIZE + REFERENCE_TRAILER_BYTE_SIZE)
+        return false;
+
+    auto read = [data](size_t offset, int bytes) {
+        uint64_t value = 0;
+        for (int i = 0; i < bytes; i++)
+            value = (value << 8) | data[offset + i];
+        return value;
+    };
+
+    size_t trailer = size - REFERENCE_TRAILER_BYTE_SIZE;
+    if (read(trailer + 12, 4) != REFERENCE_TRAILER_MAGIC)
+        return false;
+
+    uint64_t alignment_size = read(trailer + 8, 4);
+    if (alignment_size > trailer - HEADER_BYTE_SIZE)
+        return false;
+
+    reference_hash = read(trailer, 8);
+    alignment = trailer - static_cast<size_t>(alignment_size);
+    size = alignment;
+    return true;
+}
+
+bool Replay::decodeKeyframeIndex(const uint8_t* data, size_t size, uint16_t version, KeyframeIndex& index)
+{
+    index = KeyframeIndex();
+    index.frames_end = size;
+
+    auto read_u32 = [data](size_t offset) {
+        return (static_cast<uint32_t>(data[offset]) << 24) | (static_cast<uint32_t>(data[offset + 1]) << 16) |
+            (static_cast<uint32_t>(data[offset + 2]) << 8) | static_cast<uint32_t>(data[offset + 3]);
+    };
+
+    // The columnar body starts with the frame count
+    if (version & REPLAY_FLAG_COLUMNAR) {
+        if (size < HEADER_BYTE_SIZE + COLUMNAR_FRAME_COUNT_BYTE_SIZE)
+            return false;
+        index.frame_count = read_u32(HEADER_BYTE_SIZE);
+        return true;
+    }
+
+    if (replayRevision(version) < REPLAY_VERSION_KEYFRAMES)
+        return true;
+
+    if (size < HEADER_BYTE_SIZE + KEYFRAME_TRAILER_BYTE_SIZE)
+        return false;
+
+    size_t trailer = size - KEYFRAME_TRAILER_BYTE_SIZE;
+    if (read_u32(trailer + 10) != KEYFRAME_TRAILER_MAGIC)
+        return false;
+
+    index.frame_count = read_u32(trailer);
+    index.interval = static_cast<uint16_t>((data[trailer + 4] << 8) | data[trailer + 5]);
+    uint32_t keyframe_count = read_u32(trailer + 6);
+
+    if (index.interval == 0 || keyframe_count > (trailer - HEADER_BYTE_SIZE) / KEYFRAME_OFFSET_BYTE_SIZE)
+        return false;
+
+    // Runs never cross a keyframe, so the keyframes bound the frame count the decoder allocates for
+    if (index.frame_count > static_cast<uint64_t>(keyframe_count) * index.interval ||
+        (keyframe_count > 0 && index.frame_count <= static_cast<uint64_t>(keyframe_count - 1) * index.interval))
+        return false;
+
+    index.frames_end = trailer - keyframe_count * KEYFRAME_OFFSET_BYTE_SIZE;
+
+    index.offsets.resize(keyframe_count);
+    for (uint32_t i = 0; i < keyframe_count; i++) {
+        index.offsets[i] = read_u32(index.frames_end + i * KEYFRAME_OFFSET_BYTE_SIZE);
+        if (index.offsets[i] < HEADER_BYTE_SIZE || index.offsets[i] >= index.frames_end)
+            return false;
     }
 
+    return true;
+}
+
+Replay Replay::mapFile(const std::string& input_filename)
+{
+    Replay replay;
+
+    replay.mapped = MappedReplay::open(input_filename, replay.error);
+    if (replay.mapped != nullptr)
+        replay.header = replay.mapped->getHeader();
+
     return replay;
 }
 
+size_t Replay::size() const
+{
+    return mapped ? mapped->size() : frames.size();
+}
+
+FrameData Replay::getFrame(size_t index) const
+{
+    return mapped ? mapped->getFrame(index) : frames.at(index);
+}
+
+uint64_t Replay::contentHash() const
+{
+    if (!mapped)
+        return ReferenceCoder::contentHash(frames);
+
+    ReplayColumns columns;
+    columns.reserve(mapped->size());
+    for (size_t i = 0; i < mapped->size(); i++)
+        columns.push_back(mapped->getFrame(i));
+    return ReferenceCoder::contentHash(columns);
+}
+
+uint16_t Replay::overlap() const
+{
+    uint16_t overlaps = 0;
+    if (mapped) {
+        for (size_t i = 0; i < mapped->size(); i++)
+            if (mapped->getFrame(i).overlap())
+                overlaps++;
+    }
+    else {
+        // Scans the keys column only
+        for (size_t chunk = 0; chunk < frames.chunkCount(); chunk++) {
+            const uint8_t* keys = frames.getChunk(chunk).keys;
+            size_t chunk_frames = frames.chunkFrames(chunk);
+
+            for (size_t i = 0; i < chunk_frames; i++)
+                if ((keys[i] & MOVELEFT) && (keys[i] & MOVERIGHT))
+                    overlaps++;
+        }
+    }
+
+    return overlaps;
+}
+
+void Replay::buildTimeIndex()
+{
+    time_index.resize(size());
+
+    uint32_t elapsed = 0;
+    if (mapped) {
+        for (size_t i = 0; i < time_index.size(); i++) {
+            elapsed += mapped->getFrame(i).getTimestamp();
+            time_index[i] = elapsed;
+        }
+        return;
+    }
+
+    // Sums the timestamp column only
+    size_t frame = 0;
+    for (size_t chunk = 0; chunk < frames.chunkCount(); chunk++) {
+        const uint8_t* timestamps = frames.getChunk(chunk).timestamp;
+        size_t chunk_frames = frames.chunkFrames(chunk);
+
+        for (size_t i = 0; i < chunk_frames; i++) {
+            elapsed += timestamps[i];
+            time_index[frame++] = elapsed;
+        }
+    }
+}
+
+uint32_t Replay::duration() const
+{
+    return time_index.empty() ? 0 : time_index.back();
+}
+
+bool Replay::frameAtTime(double time, FrameData& frame, float origin[3], float angles[2], ReplayCursor* cursor) const
+{
+    if (time_index.empty() || time_index.size() != size())
+        return false;
+
+    auto read = [this, cursor](size_t index) {
+        return cursor != nullptr ? cursor->frameAt(*this, index) : getFrame(index);
+    };
+
+    // First frame ending after time, the position lies between it and the frame before
+    size_t next = std::upper_bound(time_index.begin(), time_index.end(), time) - time_index.begin();
+    if (next == 0 || next == time_index.size()) {
+        frame = read(next == 0 ? 0 : next - 1);
+        for (int i = 0; i < 3; i++)
+            origin[i] = static_cast<float>(frame.getOrigin()[i]);
+        for (int i = 0; i < 2; i++)
+            angles[i] = static_cast<float>(frame.getAngles()[i]);
+        return true;
+    }
+
+    frame = read(next - 1);
+    FrameData to = read(next);
+
+    uint32_t start = time_index[next - 1];
+    float fraction = static_cast<float>((time - start) / (time_index[next] - start));
+
+    for (int i = 0; i < 3; i++)
+        origin[i] = frame.getOrigin()[i] + (to.getOrigin()[i] - frame.getOrigin()[i]) * fraction;
+    for (int i = 0; i < 2; i++)
+        angles[i] = FrameData::interpolate_angle(frame.getAngles()[i], to.getAngles()[i], fraction);
+
+    return true;
+}
+
 void Replay::addFrame(const FrameData frame)
 {
     frames.push_back(frame);
@@ -89,102 +672,129 @@ void Replay::addFrame(const FrameData frame)
 
 std::vector<uint8_t> Replay::encodeHeader(const Header& header)
 {
-    std::vector<uint8_t> packed_header;
+    ByteWriter writer;
+    writer.reserve(HEADER_BYTE_SIZE);
+    encodeHeader(header, writer);
+    return writer.getBuffer();
+}
 
+void Replay::encodeHeader(const Header& header, ByteWriter& writer)
+{
     // Encode timestamp (8 bytes)
-    packed_header.push_back(static_cast<uint8_t>((header.timestamp >> 56) & 0xFF));
-    packed_header.push_back(static_cast<uint8_t>((header.timestamp >> 48) & 0xFF));
-    packed_header.push_back(static_cast<uint8_t>((header.timestamp >> 40) & 0xFF));
-    packed_header.push_back(static_cast<uint8_t>((header.timestamp >> 32) & 0xFF));
-    packed_header.push_back(static_cast<uint8_t>((header.timestamp >> 24) & 0xFF));
-    packed_header.push_back(static_cast<uint8_t>((header.timestamp >> 16) & 0xFF));
-    packed_header.push_back(static_cast<uint8_t>((header.timestamp >> 8) & 0xFF));
-    packed_header.push_back(static_cast<uint8_t>(header.timestamp & 0xFF));
+    writer.writeU64(header.timestamp);
 
     // Encode version (2 bytes)
-    packed_header.push_back(static_cast<uint8_t>((header.version >> 8) & 0xFF)); // High byte
-    packed_header.push_back(static_cast<uint8_t>(header.version & 0xFF));        // Low byte
+    writer.writeU16(header.version);
 
     // Encode map name (32 bytes, padded or truncated)
     for (size_t i = 0; i < 32; ++i) {
-        packed_header.push_back(i < header.map.size() ? header.map[i] : '\0');
+        writer.writeU8(i < header.map.size() ? header.map[i] : '\0');
     }
 
     // Encode time (3 bytes)
-    packed_header.push_back(static_cast<uint8_t>((header.time >> 16) & 0xFF)); // MSB
-    packed_header.push_back(static_cast<uint8_t>((header.time >> 8) & 0xFF));  // Middle byte
-    packed_header.push_back(static_cast<uint8_t>(header.time & 0xFF));         // LSB
+    writer.writeU24(header.time);
 
     // Encode player name (32 bytes, padded or truncated)
     for (size_t i = 0; i < 32; ++i) {
-        packed_header.push_back(i < header.name.size() ? header.name[i] : '\0');
+        writer.writeU8(i < header.name.size() ? header.name[i] : '\0');
     }
 
     // Encode SteamID (24 bytes, padded or truncated)
     for (size_t i = 0; i < 24; ++i) {
-        packed_header.push_back(i < header.steamID.size() ? header.steamID[i] : '\0');
+        writer.writeU8(i < header.steamID.size() ? header.steamID[i] : '\0');
     }
 
-    // Encode additional info (32 bytes, padded or truncated)
-    for (size_t i = 0; i < 32; ++i) {
-        packed_header.push_back(i < header.info.size() ? header.info[i] : '\0');
+    // Encode additional info (32 bytes, padded or truncated), the recording rate takes its last 2 bytes
+    bool rate = replayRevision(header.version) >= REPLAY_VERSION_RATE;
+    size_t info_size = rate ? HEADER_INFO_BYTE_SIZE - HEADER_RATE_BYTE_SIZE : HEADER_INFO_BYTE_SIZE;
+    for (size_t i = 0; i < info_size; ++i) {
+        writer.writeU8(i < header.info.size() ? header.info[i] : '\0');
     }
 
-    return packed_header;
+    if (rate)
+        writer.writeU16(header.rate);
 }
 
 Header Replay::decodeHeader(const std::vector<uint8_t>& packed_header) {
-    if (packed_header.size() < 133) {
+    if (packed_header.size() < HEADER_BYTE_SIZE) {
         throw std::invalid_argument("Header data is incomplete or corrupted.");
     }
 
+    return decodeHeader(packed_header.data());
+}
+
+Header Replay::decodeHeader(const uint8_t* data)
+{
+    FixedHeader fixed;
+    parseHeader(data, fixed);
+
     Header header;
+    header.timestamp = fixed.timestamp;
+    header.version = fixed.version;
+    header.time = fixed.time;
+    header.map = fixed.map;
+    header.name = fixed.name;
+    header.steamID = fixed.steamID;
+    header.info = fixed.info;
+    header.rate = fixed.rate;
+
+    return header;
+}
+
+void Replay::parseHeader(const uint8_t* data, FixedHeader& header)
+{
     size_t offset = 0;
 
     // Decode timestamp (8 bytes)
-    header.timestamp =
-        (static_cast<uint64_t>(packed_header[offset]) << 56) |  // Byte 1 (Most significant byte)
-        (static_cast<uint64_t>(packed_header[offset + 1]) << 48) |  // Byte 2
-        (static_cast<uint64_t>(packed_header[offset + 2]) << 40) |  // Byte 3
-        (static_cast<uint64_t>(packed_header[offset + 3]) << 32) |  // Byte 4
-        (static_cast<uint64_t>(packed_header[offset + 4]) << 24) |  // Byte 5
-        (static_cast<uint64_t>(packed_header[offset + 5]) << 16) |  // Byte 6
-        (static_cast<uint64_t>(packed_header[offset + 6]) << 8) |   // Byte 7
-        static_cast<uint64_t>(packed_header[offset + 7]);           // Byte 8 (Least significant byte)
-    offset += 8;  // Move to the next field after reading 8 bytes
+    header.timestamp = 0;
+    for (int i = 0; i < HEADER_TIMESTAMP_BYTE_SIZE; ++i)
+        header.timestamp = (header.timestamp << 8) | data[offset + i];
+    offset += HEADER_TIMESTAMP_BYTE_SIZE;
 
     // Decode version (2 bytes)
-    header.version = (static_cast<uint16_t>(packed_header[offset]) << 8) |
-        static_cast<uint16_t>(packed_header[offset + 1]);
+    header.version = static_cast<uint16_t>((data[offset] << 8) | data[offset + 1]);
+    offset += HEADER_VERSION_BYTE_SIZE;
 
-    offset += 2;
+    // Strings are copied whole, the terminator stops them at the first null padding byte
+    auto read_string = [data, &offset](char* output, size_t size) {
+        memcpy(output, data + offset, size);
+        output[size] = '\0';
+        offset += size;
+    };
 
-    // Decode map name (32 bytes, trim null padding)
-    header.map = std::string(packed_header.begin() + offset, packed_header.begin() + offset + 32);
-    header.map = header.map.substr(0, header.map.find('\0'));
-    offset += 32;
+    read_string(header.map, HEADER_MAP_BYTE_SIZE);
 
     // Decode time (3 bytes)
-    header.time = (static_cast<uint16_t>(packed_header[offset]) << 16) |
-        (static_cast<uint16_t>(packed_header[offset + 1]) << 8) |
-        static_cast<uint16_t>(packed_header[offset + 2]);
-
+    header.time = (static_cast<uint32_t>(data[offset]) << 16) | (static_cast<uint32_t>(data[offset + 1]) << 8) | data[offset + 2];
     offset += 3;
 
-    // Decode player name (32 bytes, trim null padding)
-    header.name = std::string(packed_header.begin() + offset, packed_header.begin() + offset + 32);
-    header.name = header.name.substr(0, header.name.find('\0'));
-    offset += 32;
+    read_string(header.name, HEADER_NAME_BYTE_SIZE);
+    read_string(header.steamID, HEADER_STEAMID_BYTE_SIZE);
+    read_string(header.info, HEADER_INFO_BYTE_SIZE);
 
-    // Decode SteamID (24 bytes, trim null padding)
-    header.steamID = std::string(packed_header.begin() + offset, packed_header.begin() + offset + 24);
-    header.steamID = header.steamID.substr(0, header.steamID.find('\0'));
-    offset += 24;
+    header.rate = DEFAULT_RECORD_RATE;
+    if (replayRevision(header.version) >= REPLAY_VERSION_RATE) {
+        size_t rate_offset = offset - HEADER_RATE_BYTE_SIZE;
+        header.rate = static_cast<uint16_t>((data[rate_offset] << 8) | data[rate_offset + 1]);
+        header.info[HEADER_INFO_BYTE_SIZE - HEADER_RATE_BYTE_SIZE] = '\0';
+    }
+}
 
-    // Decode additional info (32 bytes, trim null padding)
-    header.info = std::string(packed_header.begin() + offset, packed_header.begin() + offset + 32);
-    header.info = header.info.substr(0, header.info.find('\0'));
-    offset += 32;
+bool Replay::peekHeader(const std::string& input_filename, FixedHeader& header)
+{
+    std::ifstream input_file(input_filename, std::ios::binary);
+    if (!input_file.is_open()) {
+        std::cerr << "Error opening input file: " << input_filename << std::endl;
+        return false;
+    }
 
-    return header;
-}
\ No newline at end of file
+    uint8_t data[HEADER_BYTE_SIZE];
+    input_file.read(reinterpret_cast<char*>(data), HEADER_BYTE_SIZE);
+    if (input_file.gcount() != HEADER_BYTE_SIZE) {
+        std::cerr << "Replay file is too small: " << input_filename << std::endl;
+        return false;
+    }
+
+    parseHeader(data, header);
+    return true;
+}
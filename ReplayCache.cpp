@@ -0,0 +1,265 @@
+#include "ReplayCache.h"
+#include "ReplayCatalog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+struct CachedImage {
+    fs::file_time_type used;
+    uint64_t size;
+    fs::path path;
+};
+
+}
+
+ReplayCache::ReplayCache(const std::string& directory) : directory(directory)
+{
+    std::error_code error;
+    if (this->directory.empty()) {
+        // tmpfs keeps the images in memory without tying them to the server process
+        fs::path base = fs::is_directory("/dev/shm", error) ? fs::path("/dev/shm") : fs::temp_directory_path(error);
+        this->directory = (base / "amxx_replays").string();
+    }
+
+    fs::create_directories(this->directory, error);
+}
+
+void ReplayCache::setBudget(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    budget = bytes;
+    evict();
+}
+
+Replay ReplayCache::decode(const std::string& path)
+{
+    Replay replay;
+    if (load(path, replay))
+        return replay;
+
+    replay = ReplayCatalog::decodeFile(path);
+    if (replay.size() > 0)
+        store(path, replay);
+
+    return replay;
+}
+
+bool ReplayCache::load(const std::string& path, Replay& replay)
+{
+    std::string image_path;
+    if (budget == 0 || !imagePath(path, image_path))
+        return false;
+
+    std::vector<uint8_t> buffer;
+    std::error_code error;
+    if (!fs::exists(image_path, error) || !Replay::readFile(image_path, buffer))
+        return false;
+
+    const uint8_t* data = buffer.data();
+    size_t header_size = CACHE_HEADER_BYTE_SIZE + HEADER_BYTE_SIZE;
+    if (buffer.size() < header_size)
+        return false;
+
+    auto read_u32 = [](const uint8_t* bytes) {
+        return (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) |
+            (static_cast<uint32_t>(bytes[2]) << 8) | static_cast<uint32_t>(bytes[3]);
+    };
+    uint32_t magic = read_u32(data);
+    uint16_t version = static_cast<uint16_t>((data[4] << 8) | data[5]);
+    uint32_t frames = read_u32(data + 6);
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION ||
+        buffer.size() != header_size + static_cast<uint64_t>(frames) * CACHE_FRAME_BYTE_SIZE) {
+        std::cerr << "Invalid cached replay: " << image_path << std::endl;
+        fs::remove(image_path, error);
+        return false;
+    }
+
+    replay = Replay();
+    replay.setHeader(Replay::decodeHeader(data + CACHE_HEADER_BYTE_SIZE));
+
+    // The columns were written in the byte order of this machine, they are copied back as is
+    ReplayColumns* columns = replay.getFrames();
+    columns->resize(frames);
+
+    const uint8_t* field = data + header_size;
+    auto read = [&field](void* column, size_t bytes) {
+        memcpy(column, field, bytes);
+        field += bytes;
+    };
+
+    for (size_t chunk = 0; chunk < columns->chunkCount(); chunk++) {
+        FrameChunk& frame_chunk = columns->getChunk(chunk);
+        size_t count = columns->chunkFrames(chunk);
+
+        read(frame_chunk.timestamp, count);
+        for (int axis = 0; axis < 3; axis++)
+            read(frame_chunk.origin[axis], count * sizeof(int16_t));
+        for (int axis = 0; axis < 2; axis++)
+            read(frame_chunk.angles[axis], count * sizeof(int16_t));
+        read(frame_chunk.speed, count * sizeof(int16_t));
+        read(frame_chunk.fps, count);
+        read(frame_chunk.keys, count);
+        read(frame_chunk.strafes, count);
+        read(frame_chunk.sync, count);
+        read(frame_chunk.state, count);
+    }
+
+    // Marks the image as recently used for the eviction order
+    fs::last_write_time(image_path, fs::file_time_type::clock::now(), error);
+    return true;
+}
+
+bool ReplayCache::store(const std::string& path, Replay& replay)
+{
+    ReplayColumns* columns = replay.getFrames();
+    uint64_t image_size = CACHE_HEADER_BYTE_SIZE + HEADER_BYTE_SIZE + static_cast<uint64_t>(columns->size()) * CACHE_FRAME_BYTE_SIZE;
+
+    std::string image_path;
+    if (!imagePath(path, image_path))
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Older versions of the same file are never hit again
+    std::string prefix = keyPrefix(path);
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        std::string name = file.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0 && file.path().string() != image_path)
+            fs::remove(file.path(), error);
+    }
+
+    if (image_size > budget)
+        return false;
+
+    ByteWriter writer;
+    writer.reserve(image_size);
+    writer.writeU32(CACHE_MAGIC);
+    writer.writeU16(CACHE_VERSION);
+    writer.writeU32(static_cast<uint32_t>(columns->size()));
+    Replay::encodeHeader(replay.getHeader(), writer);
+
+    for (size_t chunk = 0; chunk < columns->chunkCount(); chunk++) {
+        const FrameChunk& frame_chunk = columns->getChunk(chunk);
+        size_t count = columns->chunkFrames(chunk);
+
+        writer.writeBytes(frame_chunk.timestamp, count);
+        for (int axis = 0; axis < 3; axis++)
+            writer.writeBytes(frame_chunk.origin[axis], count * sizeof(int16_t));
+        for (int axis = 0; axis < 2; axis++)
+            writer.writeBytes(frame_chunk.angles[axis], count * sizeof(int16_t));
+        writer.writeBytes(frame_chunk.speed, count * sizeof(int16_t));
+        writer.writeBytes(frame_chunk.fps, count);
+        writer.writeBytes(frame_chunk.keys, count);
+        writer.writeBytes(frame_chunk.strafes, count);
+        writer.writeBytes(frame_chunk.sync, count);
+        writer.writeBytes(frame_chunk.state, count);
+    }
+
+    if (!Replay::writeFile(image_path, writer.data(), writer.size()))
+        return false;
+
+    evict();
+    return true;
+}
+
+void ReplayCache::invalidate(const std::string& path)
+{
+    std::string prefix = keyPrefix(path);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        std::string name = file.path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) == 0)
+            fs::remove(file.path(), error);
+    }
+}
+
+void ReplayCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        if (file.path().extension() == CACHE_EXTENSION)
+            fs::remove(file.path(), error);
+    }
+}
+
+uint64_t ReplayCache::usage()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t total = 0;
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        if (file.path().extension() == CACHE_EXTENSION)
+            total += file.file_size(error);
+    }
+    return total;
+}
+
+std::string ReplayCache::keyPrefix(const std::string& path)
+{
+    std::error_code error;
+    fs::path absolute = fs::absolute(path, error);
+    std::string key = error ? path : absolute.lexically_normal().string();
+
+    // FNV-1a of the absolute path
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : key) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+
+    char prefix[20];
+    snprintf(prefix, sizeof(prefix), "%016llx-", static_cast<unsigned long long>(hash));
+    return prefix;
+}
+
+bool ReplayCache::imagePath(const std::string& path, std::string& image_path) const
+{
+    uint64_t size;
+    int64_t modified;
+    if (!Replay::fileInfo(path, size, modified))
+        return false;
+
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), "%llx-%llx", static_cast<unsigned long long>(size), static_cast<unsigned long long>(modified));
+    image_path = directory + "/" + keyPrefix(path) + suffix + CACHE_EXTENSION;
+    return true;
+}
+
+void ReplayCache::evict()
+{
+    std::vector<CachedImage> images;
+    uint64_t total = 0;
+
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        if (file.path().extension() != CACHE_EXTENSION)
+            continue;
+
+        CachedImage image{ file.last_write_time(error), file.file_size(error), file.path() };
+        total += image.size;
+        images.push_back(image);
+    }
+
+    std::sort(images.begin(), images.end(), [](const CachedImage& a, const CachedImage& b) {
+        return a.used < b.used;
+    });
+
+    for (const CachedImage& image : images) {
+        if (total <= budget)
+            break;
+
+        fs::remove(image.path, error);
+        total -= image.size;
+    }
+}
@@ -0,0 +1,386 @@
+#include "ReplayCatalog.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+void fillStats(Replay& replay, CatalogEntry& entry)
+{
+    ReplayColumns* frames = replay.getFrames();
+
+    uint64_t duration = 0;
+    uint64_t speed_sum = 0;
+    int max_speed = 0;
+
+    for (size_t chunk = 0; chunk < frames->chunkCount(); chunk++) {
+        const FrameChunk& columns = frames->getChunk(chunk);
+        size_t chunk_frames = frames->chunkFrames(chunk);
+
+        for (size_t i = 0; i < chunk_frames; i++) {
+            duration += columns.timestamp[i];
+            speed_sum += static_cast<uint16_t>(columns.speed[i]);
+            max_speed = std::max<int>(max_speed, static_cast<uint16_t>(columns.speed[i]));
+        }
+    }
+
+    entry.frames = static_cast<uint32_t>(frames->size());
+    entry.duration = static_cast<uint32_t>(std::min<uint64_t>(duration, UINT32_MAX));
+    entry.max_speed = static_cast<uint16_t>(max_speed);
+    entry.avg_speed = static_cast<uint16_t>(frames->empty() ? 0 : speed_sum / frames->size());
+    entry.overlaps = replay.overlap();
+}
+
+uint64_t readU64(const uint8_t* data)
+{
+    uint64_t value = 0;
+    for (int i = 0; i < 8; i++)
+        value = (value << 8) | data[i];
+    return value;
+}
+
+uint32_t readU32(const uint8_t* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) | (static_cast<uint32_t>(data[1]) << 16) |
+        (static_cast<uint32_t>(data[2]) << 8) | static_cast<uint32_t>(data[3]);
+}
+
+uint16_t readU16(const uint8_t* data)
+{
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+}
+
+bool ReplayCatalog::load()
+{
+    entries.clear();
+
+    // Also runs on the game thread, an unreadable directory is a missing catalog
+    std::string path = directory + "/" + CATALOG_FILENAME;
+    std::error_code error;
+    if (!fs::exists(path, error))
+        return false;
+
+    std::vector<uint8_t> buffer;
+    if (!Replay::readFile(path, buffer) || buffer.size() < CATALOG_HEADER_BYTE_SIZE)
+        return false;
+
+    if (readU32(buffer.data()) != CATALOG_MAGIC || readU16(buffer.data() + 4) != CATALOG_VERSION) {
+        std::cerr << "Invalid replay catalog: " << path << std::endl;
+        return false;
+    }
+
+    // Entries may grow in later versions, the stored size is used to step over them
+    size_t entry_size = readU16(buffer.data() + 6);
+    uint32_t count = readU32(buffer.data() + 8);
+    if (entry_size < CATALOG_ENTRY_BYTE_SIZE || count > (buffer.size() - CATALOG_HEADER_BYTE_SIZE) / entry_size) {
+        std::cerr << "Invalid replay catalog: " << path << std::endl;
+        return false;
+    }
+
+    entries.resize(count);
+    const uint8_t* data = buffer.data() + CATALOG_HEADER_BYTE_SIZE;
+    for (CatalogEntry& entry : entries) {
+        const uint8_t* field = data;
+
+        memcpy(entry.file, field, CATALOG_FILE_BYTE_SIZE);
+        entry.file[CATALOG_FILE_BYTE_SIZE] = '\0';
+        field += CATALOG_FILE_BYTE_SIZE;
+
+        memcpy(entry.packed_header, field, HEADER_BYTE_SIZE);
+        Replay::parseHeader(entry.packed_header, entry.header);
+        field += HEADER_BYTE_SIZE;
+
+        entry.frames = readU32(field);
+        entry.size = readU64(field + 4);
+        entry.modified = static_cast<int64_t>(readU64(field + 12));
+        entry.duration = readU32(field + 20);
+        entry.max_speed = readU16(field + 24);
+        entry.avg_speed = readU16(field + 26);
+        entry.overlaps = readU16(field + 28);
+        entry.content_hash = readU64(field + 30);
+        entry.reference_hash = readU64(field + 38);
+
+        data += entry_size;
+    }
+
+    return true;
+}
+
+bool ReplayCatalog::save() const
+{
+    ByteWriter writer;
+    writer.reserve(CATALOG_HEADER_BYTE_SIZE + entries.size() * CATALOG_ENTRY_BYTE_SIZE);
+
+    writer.writeU32(CATALOG_MAGIC);
+    writer.writeU16(CATALOG_VERSION);
+    writer.writeU16(CATALOG_ENTRY_BYTE_SIZE);
+    writer.writeU32(static_cast<uint32_t>(entries.size()));
+
+    for (const CatalogEntry& entry : entries) {
+        // File names are null padded like the header strings
+        size_t length = strnlen(entry.file, CATALOG_FILE_BYTE_SIZE);
+        writer.writeBytes(entry.file, length);
+        for (size_t i = length; i < CATALOG_FILE_BYTE_SIZE; i++)
+            writer.writeU8(0);
+
+        writer.writeBytes(entry.packed_header, HEADER_BYTE_SIZE);
+        writer.writeU32(entry.frames);
+        writer.writeU64(entry.size);
+        writer.writeU64(static_cast<uint64_t>(entry.modified));
+        writer.writeU32(entry.duration);
+        writer.writeU16(entry.max_speed);
+        writer.writeU16(entry.avg_speed);
+        writer.writeU16(entry.overlaps);
+        writer.writeU64(entry.content_hash);
+        writer.writeU64(entry.reference_hash);
+    }
+
+    return Replay::writeFile(directory + "/" + CATALOG_FILENAME, writer.data(), writer.size());
+}
+
+void ReplayCatalog::rebuild()
+{
+    entries.clear();
+
+    std::vector<std::string> pending;
+    std::error_code error;
+    for (const auto& file : fs::directory_iterator(directory, error)) {
+        if (!file.is_regular_file() || !isReplayFile(file.path().filename().string()))
+            continue;
+
+        CatalogEntry entry;
+        if (describe(file.path().string(), entry, this))
+            entries.push_back(entry);
+        else
+            pending.push_back(file.path().string());
+    }
+
+    // A reference replay listed before its reference is described on a later pass, one pass per level at most
+    while (!pending.empty()) {
+        std::vector<std::string> remaining;
+        for (const std::string& path : pending) {
+            CatalogEntry entry;
+            if (describe(path, entry, this))
+                entries.push_back(entry);
+            else
+                remaining.push_back(path);
+        }
+
+        if (remaining.size() == pending.size())
+            break;
+        pending.swap(remaining);
+    }
+}
+
+void ReplayCatalog::update(const CatalogEntry& entry)
+{
+    for (CatalogEntry& existing : entries) {
+        if (strcmp(existing.file, entry.file) == 0) {
+            existing = entry;
+            return;
+        }
+    }
+
+    entries.push_back(entry);
+}
+
+bool ReplayCatalog::remove(const std::string& file)
+{
+    auto it = std::find_if(entries.begin(), entries.end(), [&file](const CatalogEntry& entry) {
+        return file == entry.file;
+    });
+    if (it == entries.end())
+        return false;
+
+    entries.erase(it);
+    return true;
+}
+
+std::vector<size_t> ReplayCatalog::find(const CatalogFilter& filter, CatalogSort sort) const
+{
+    std::vector<size_t> result;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const FixedHeader& header = entries[i].header;
+        if ((filter.map.empty() || filter.map == header.map) &&
+            (filter.steamID.empty() || filter.steamID == header.steamID) &&
+            (filter.info.empty() || filter.info == header.info))
+            result.push_back(i);
+    }
+
+    auto order = [this, sort](size_t a, size_t b) {
+        const FixedHeader& x = entries[a].header;
+        const FixedHeader& y = entries[b].header;
+        switch (sort) {
+        case CATALOG_SORT_TIME: return x.time < y.time;
+        case CATALOG_SORT_DATE: return x.timestamp > y.timestamp;
+        case CATALOG_SORT_NAME: return strcmp(x.name, y.name) < 0;
+        default: return false;
+        }
+    };
+
+    if (sort != CATALOG_SORT_NONE)
+        std::stable_sort(result.begin(), result.end(), order);
+
+    return result;
+}
+
+const CatalogEntry* ReplayCatalog::findContent(uint64_t content_hash) const
+{
+    for (const CatalogEntry& entry : entries) {
+        if (entry.content_hash == content_hash)
+            return &entry;
+    }
+
+    return nullptr;
+}
+
+bool ReplayCatalog::keepReferenced(const std::string& file, uint64_t content_hash, CatalogEntry& kept)
+{
+    kept.file[0] = '\0';
+
+    auto it = std::find_if(entries.begin(), entries.end(), [&file](const CatalogEntry& entry) {
+        return file == entry.file;
+    });
+    if (it == entries.end() || it->content_hash == content_hash)
+        return true;
+
+    uint64_t previous_hash = it->content_hash;
+    bool referenced = std::any_of(entries.begin(), entries.end(), [previous_hash](const CatalogEntry& entry) {
+        return entry.reference_hash == previous_hash;
+    });
+    if (!referenced)
+        return true;
+
+    char suffix[18];
+    snprintf(suffix, sizeof(suffix), ".%016llx", static_cast<unsigned long long>(previous_hash));
+    std::string kept_file = file + suffix;
+    if (kept_file.size() > CATALOG_FILE_BYTE_SIZE)
+        return false;
+
+    std::error_code error;
+    fs::rename(directory + "/" + file, directory + "/" + kept_file, error);
+    if (error) {
+        std::cerr << "Cannot keep referenced replay " << file << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    // The same frames kept earlier under this name are replaced, which moves the entries
+    remove(kept_file);
+
+    it = std::find_if(entries.begin(), entries.end(), [&file](const CatalogEntry& entry) {
+        return file == entry.file;
+    });
+    memset(it->file, 0, sizeof(it->file));
+    memcpy(it->file, kept_file.c_str(), kept_file.size());
+    kept = *it;
+    return true;
+}
+
+Replay ReplayCatalog::decode(const std::string& path, int depth) const
+{
+    Replay replay = Replay::decode(path);
+    if (replay.getError().status != DECODE_MISSING_REFERENCE || depth >= MAX_REFERENCE_DEPTH)
+        return replay;
+
+    const CatalogEntry* entry = findContent(replay.getReferenceHash());
+    if (entry == nullptr)
+        return replay;
+
+    Replay reference = decode(directory + "/" + entry->file, depth + 1);
+    if (reference.getError().status != DECODE_OK)
+        return replay;
+
+    // The file is read again, decode stops at the reference trailer when the reference is missing
+    return Replay::decode(path, STREAM_ALL, &reference);
+}
+
+Replay ReplayCatalog::decodeFile(const std::string& path)
+{
+    Replay replay = Replay::decode(path);
+    if (replay.getError().status != DECODE_MISSING_REFERENCE)
+        return replay;
+
+    // Never rebuilt here, a rebuild decodes every replay of the directory
+    ReplayCatalog catalog(directoryOf(path));
+    if (!catalog.load())
+        return replay;
+
+    return catalog.decode(path);
+}
+
+bool ReplayCatalog::describe(const std::string& path, Replay& replay, CatalogEntry& entry)
+{
+    std::string file = fileOf(path);
+    if (file.size() > CATALOG_FILE_BYTE_SIZE)
+        return false;
+
+    memset(&entry, 0, sizeof(entry));
+    memcpy(entry.file, file.c_str(), file.size());
+
+    if (!Replay::fileInfo(path, entry.size, entry.modified))
+        return false;
+
+    ByteWriter header;
+    Replay::encodeHeader(replay.getHeader(), header);
+    memcpy(entry.packed_header, header.data(), HEADER_BYTE_SIZE);
+    Replay::parseHeader(entry.packed_header, entry.header);
+
+    fillStats(replay, entry);
+    entry.content_hash = replay.contentHash();
+    entry.reference_hash = replay.getReferenceHash();
+    return true;
+}
+
+bool ReplayCatalog::describe(const std::string& path, CatalogEntry& entry, const ReplayCatalog* catalog)
+{
+    std::vector<uint8_t> buffer;
+    if (!Replay::readFile(path, buffer) || buffer.size() < HEADER_BYTE_SIZE)
+        return false;
+
+    // Anything else stored in the directory is not a replay
+    FixedHeader header;
+    Replay::parseHeader(buffer.data(), header);
+    uint16_t revision = replayRevision(header.version);
+    if (revision < REPLAY_VERSION_LEGACY || revision > REPLAY_VERSION)
+        return false;
+
+    Replay replay = Replay::decode(buffer.data(), buffer.size());
+    if (replay.getError().status == DECODE_MISSING_REFERENCE)
+        replay = catalog != nullptr ? catalog->decode(path) : decodeFile(path);
+    if (replay.getError().status != DECODE_OK || !describe(path, replay, entry))
+        return false;
+
+    // Keep the header exactly as stored, including the format flags of the file
+    memcpy(entry.packed_header, buffer.data(), HEADER_BYTE_SIZE);
+    Replay::parseHeader(entry.packed_header, entry.header);
+    return true;
+}
+
+std::string ReplayCatalog::directoryOf(const std::string& path)
+{
+    size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? std::string(".") : path.substr(0, separator);
+}
+
+std::string ReplayCatalog::fileOf(const std::string& path)
+{
+    size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? path : path.substr(separator + 1);
+}
+
+bool ReplayCatalog::isReplayFile(const std::string& file)
+{
+    auto ends_with = [&file](const char* suffix) {
+        size_t length = strlen(suffix);
+        return file.size() >= length && file.compare(file.size() - length, length, suffix) == 0;
+    };
+
+    return file != CATALOG_FILENAME && !ends_with(".tmp");
+}
@@ -0,0 +1,105 @@
+#include "ReplayColumns.h"
+
+ReplayColumns::ReplayColumns(const ReplayColumns& other)
+{
+    *this = other;
+}
+
+ReplayColumns& ReplayColumns::operator=(const ReplayColumns& other)
+{
+    if (this == &other)
+        return *this;
+
+    chunks.clear();
+    for (size_t i = 0; i < other.chunkCount(); ++i)
+        chunks.emplace_back(new FrameChunk(*other.chunks[i]));
+    count = other.count;
+
+    return *this;
+}
+
+void ReplayColumns::reserve(size_t frames)
+{
+    size_t needed = (frames + FRAMES_PER_CHUNK - 1) / FRAMES_PER_CHUNK;
+
+    chunks.reserve(needed);
+    while (chunks.size() < needed)
+        chunks.emplace_back(new FrameChunk);
+}
+
+void ReplayColumns::release()
+{
+    chunks.clear();
+    chunks.shrink_to_fit();
+    count = 0;
+}
+
+void ReplayColumns::resize(size_t frames)
+{
+    reserve(frames);
+
+    for (size_t index = count; index < frames;) {
+        FrameChunk& chunk = *chunks[index / FRAMES_PER_CHUNK];
+        size_t first = index % FRAMES_PER_CHUNK;
+        size_t length = std::min<size_t>(FRAMES_PER_CHUNK - first, frames - index);
+
+        std::fill_n(chunk.timestamp + first, length, 0);
+        for (int axis = 0; axis < 3; ++axis)
+            std::fill_n(chunk.origin[axis] + first, length, 0);
+        for (int axis = 0; axis < 2; ++axis)
+            std::fill_n(chunk.angles[axis] + first, length, 0);
+        std::fill_n(chunk.speed + first, length, 0);
+        std::fill_n(chunk.fps + first, length, 0);
+        std::fill_n(chunk.keys + first, length, 0);
+        std::fill_n(chunk.strafes + first, length, 0);
+        std::fill_n(chunk.sync + first, length, 0);
+        std::fill_n(chunk.state + first, length, 0);
+
+        index += length;
+    }
+
+    count = frames;
+}
+
+void ReplayColumns::push_back(const FrameData& frame)
+{
+    // Only a new chunk is allocated when the last one is full, frames already recorded stay in place
+    if (count == chunks.size() * FRAMES_PER_CHUNK)
+        chunks.emplace_back(new FrameChunk);
+
+    FrameChunk& chunk = *chunks[count / FRAMES_PER_CHUNK];
+    size_t i = count % FRAMES_PER_CHUNK;
+
+    const int* frame_origin = frame.getOrigin();
+    const int* frame_angles = frame.getAngles();
+
+    chunk.timestamp[i] = static_cast<uint8_t>(frame.getTimestamp());
+    for (int axis = 0; axis < 3; ++axis)
+        chunk.origin[axis][i] = static_cast<int16_t>(frame_origin[axis]);
+    for (int axis = 0; axis < 2; ++axis)
+        chunk.angles[axis][i] = static_cast<int16_t>(frame_angles[axis]);
+    chunk.speed[i] = static_cast<int16_t>(frame.getSpeed());
+    chunk.fps[i] = static_cast<uint8_t>(frame.getFPS());
+    chunk.keys[i] = static_cast<uint8_t>(FrameData::convertKeys(frame.getKeys()));
+    chunk.strafes[i] = static_cast<uint8_t>(frame.getStrafes());
+    chunk.sync[i] = static_cast<uint8_t>(frame.getSync());
+    chunk.state[i] = (frame.isGrounded() ? FRAME_STATE_GROUNDED : 0) | (frame.hasGravity() ? FRAME_STATE_GRAVITY : 0);
+
+    count++;
+}
+
+FrameData ReplayColumns::at(size_t index) const
+{
+    if (index >= count)
+        throw std::out_of_range("Frame index out of range");
+
+    const FrameChunk& chunk = *chunks[index / FRAMES_PER_CHUNK];
+    size_t i = index % FRAMES_PER_CHUNK;
+
+    int frame_origin[3] = { chunk.origin[0][i], chunk.origin[1][i], chunk.origin[2][i] };
+    int frame_angles[2] = { chunk.angles[0][i], chunk.angles[1][i] };
+
+    return FrameData(chunk.timestamp[i], frame_origin, frame_angles, chunk.speed[i], chunk.fps[i],
+        FrameData::decompactKeys(chunk.keys[i]), chunk.strafes[i], chunk.sync[i],
+        (chunk.state[i] & FRAME_STATE_GROUNDED) != 0, (chunk.state[i] & FRAME_STATE_GRAVITY) != 0);
+}
@@ -0,0 +1,46 @@
+#include "ReplayCursor.h"
+
+bool ReplayCursor::next(const Replay& replay, FrameData& frame)
+{
+    if (position >= replay.size())
+        return false;
+
+    frame = frameAt(replay, position++);
+    return true;
+}
+
+FrameData ReplayCursor::frameAt(const Replay& replay, size_t index)
+{
+    if (!replay.isMapped())
+        return replay.getFrame(index);
+
+    // Refilled once per keyframe interval, the mapping decodes the block sequentially from its keyframe.
+    // The first frame of the next block is included, a frame and the one after it never take two refills.
+    if (index < window_start || index >= window_start + window.size()) {
+        window_start = index - index % KEYFRAME_INTERVAL;
+        size_t count = std::min<size_t>(KEYFRAME_INTERVAL + 1, replay.size() - window_start);
+
+        window.resize(count);
+        for (size_t i = 0; i < count; i++)
+            window[i] = replay.getFrame(window_start + i);
+    }
+
+    return window[index - window_start];
+}
+
+bool ReplayCursor::seek(const Replay& replay, size_t frame)
+{
+    if (frame >= replay.size())
+        return false;
+
+    position = frame;
+    return true;
+}
+
+void ReplayCursor::release()
+{
+    replay_id = -1;
+    position = 0;
+    window.clear();
+    window_start = 0;
+}
@@ -0,0 +1,458 @@
+#include "Simd.h"
+
+#include <cstring>
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#define SIMD_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit the instructions for functions that ask for them, the module is built for plain i686
+#if defined(SIMD_X86) && defined(__GNUC__)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+namespace {
+
+typedef int16_t (*PrefixSumFn)(int16_t*, size_t, int16_t);
+typedef void (*DeltaFn)(const int16_t*, size_t, int16_t, int16_t*);
+typedef size_t (*ZigzagBytesFn)(const int16_t*, size_t, uint8_t*);
+typedef size_t (*UnzigzagBytesFn)(const uint8_t*, size_t, int16_t*);
+
+struct Kernels
+{
+    PrefixSumFn prefixSum;
+    DeltaFn delta;
+    ZigzagBytesFn zigzagBytes;
+    UnzigzagBytesFn unzigzagBytes;
+};
+
+// Scalar versions, also used for the tails of the vector loops
+
+int16_t prefixSumScalar(int16_t* values, size_t count, int16_t carry)
+{
+    for (size_t i = 0; i < count; i++) {
+        carry = static_cast<int16_t>(carry + values[i]);
+        values[i] = carry;
+    }
+    return carry;
+}
+
+void deltaScalar(const int16_t* values, size_t count, int16_t prev, int16_t* deltas)
+{
+    for (size_t i = 0; i < count; i++) {
+        deltas[i] = static_cast<int16_t>(values[i] - prev);
+        prev = values[i];
+    }
+}
+
+size_t zigzagBytesScalar(const int16_t* deltas, size_t count, uint8_t* output)
+{
+    for (size_t i = 0; i < count; i++) {
+        int value = deltas[i];
+        if (value < -64 || value > 63)
+            return i;
+        output[i] = static_cast<uint8_t>((static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31));
+    }
+    return count;
+}
+
+size_t unzigzagBytesScalar(const uint8_t* data, size_t count, int16_t* deltas)
+{
+    for (size_t i = 0; i < count; i++) {
+        int value = data[i];
+        if (value & 0x80)
+            return i;
+        deltas[i] = static_cast<int16_t>((value >> 1) ^ -(value & 1));
+    }
+    return count;
+}
+
+// Slice-by-8 tables of the reflected Castagnoli polynomial
+struct Crc32cTable
+{
+    uint32_t entries[8][256];
+
+    Crc32cTable()
+    {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0x82F63B78 & (0u - (crc & 1)));
+            entries[0][i] = crc;
+        }
+
+        for (int slice = 1; slice < 8; slice++)
+            for (uint32_t i = 0; i < 256; i++)
+                entries[slice][i] = (entries[slice - 1][i] >> 8) ^ entries[0][entries[slice - 1][i] & 0xFF];
+    }
+};
+
+const Crc32cTable g_Crc32cTable;
+
+uint32_t crc32cScalar(const uint8_t* data, size_t size, uint32_t crc)
+{
+    const uint32_t (*table)[256] = g_Crc32cTable.entries;
+    crc = ~crc;
+
+    for (; size >= 8; data += 8, size -= 8) {
+        uint32_t low = crc ^ (data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<uint32_t>(data[3]) << 24));
+        uint32_t high = data[4] | (data[5] << 8) | (data[6] << 16) | (static_cast<uint32_t>(data[7]) << 24);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+            table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+    }
+
+    for (; size > 0; data++, size--)
+        crc = table[0][(crc ^ *data) & 0xFF] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#ifdef SIMD_X86
+
+SIMD_TARGET("sse2")
+int16_t prefixSumSSE2(int16_t* values, size_t count, int16_t carry)
+{
+    __m128i carry_vector = _mm_set1_epi16(carry);
+    size_t i = 0;
+
+    for (; i + 8 <= count; i += 8) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi16(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi16(x, carry_vector);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), x);
+
+        // Broadcast the last lane as the carry of the next block
+        carry_vector = _mm_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+        carry_vector = _mm_unpackhi_epi64(carry_vector, carry_vector);
+    }
+
+    carry = static_cast<int16_t>(_mm_extract_epi16(carry_vector, 0));
+    return prefixSumScalar(values + i, count - i, carry);
+}
+
+SIMD_TARGET("sse2")
+void deltaSSE2(const int16_t* values, size_t count, int16_t prev, int16_t* deltas)
+{
+    if (count == 0)
+        return;
+
+    deltas[0] = static_cast<int16_t>(values[0] - prev);
+
+    size_t i = 1;
+    for (; i + 8 <= count; i += 8) {
+        __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        __m128i previous = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i - 1));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(deltas + i), _mm_sub_epi16(current, previous));
+    }
+
+    deltaScalar(values + i, count - i, values[i - 1], deltas + i);
+}
+
+SIMD_TARGET("sse2")
+size_t zigzagBytesSSE2(const int16_t* deltas, size_t count, uint8_t* output)
+{
+    const __m128i low = _mm_set1_epi16(-65);
+    const __m128i high = _mm_set1_epi16(64);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas + i + 8));
+
+        __m128i small_a = _mm_and_si128(_mm_cmpgt_epi16(a, low), _mm_cmplt_epi16(a, high));
+        __m128i small_b = _mm_and_si128(_mm_cmpgt_epi16(b, low), _mm_cmplt_epi16(b, high));
+        if (_mm_movemask_epi8(_mm_packs_epi16(small_a, small_b)) != 0xFFFF)
+            break;
+
+        a = _mm_xor_si128(_mm_slli_epi16(a, 1), _mm_srai_epi16(a, 15));
+        b = _mm_xor_si128(_mm_slli_epi16(b, 1), _mm_srai_epi16(b, 15));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_packus_epi16(a, b));
+    }
+
+    return i + zigzagBytesScalar(deltas + i, count - i, output + i);
+}
+
+SIMD_TARGET("sse2")
+size_t unzigzagBytesSSE2(const uint8_t* data, size_t count, int16_t* deltas)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        if (_mm_movemask_epi8(bytes) != 0)
+            break;
+
+        __m128i a = _mm_unpacklo_epi8(bytes, zero);
+        __m128i b = _mm_unpackhi_epi8(bytes, zero);
+        a = _mm_xor_si128(_mm_srli_epi16(a, 1), _mm_sub_epi16(zero, _mm_and_si128(a, one)));
+        b = _mm_xor_si128(_mm_srli_epi16(b, 1), _mm_sub_epi16(zero, _mm_and_si128(b, one)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(deltas + i), a);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(deltas + i + 8), b);
+    }
+
+    return i + unzigzagBytesScalar(data + i, count - i, deltas + i);
+}
+
+SIMD_TARGET("avx2")
+int16_t prefixSumAVX2(int16_t* values, size_t count, int16_t carry)
+{
+    __m256i carry_vector = _mm256_set1_epi16(carry);
+    size_t i = 0;
+
+    for (; i + 16 <= count; i += 16) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+
+        // Prefix sum inside each 128 bit lane
+        x = _mm256_add_epi16(x, _mm256_slli_si256(x, 2));
+        x = _mm256_add_epi16(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi16(x, _mm256_slli_si256(x, 8));
+
+        // Carry the last value of the low lane into the high lane
+        __m256i lane_last = _mm256_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+        lane_last = _mm256_unpackhi_epi64(lane_last, lane_last);
+        x = _mm256_add_epi16(x, _mm256_permute2x128_si256(lane_last, lane_last, 0x08));
+
+        x = _mm256_add_epi16(x, carry_vector);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(values + i), x);
+
+        carry_vector = _mm256_shufflehi_epi16(x, _MM_SHUFFLE(3, 3, 3, 3));
+        carry_vector = _mm256_permute4x64_epi64(carry_vector, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+
+    carry = static_cast<int16_t>(_mm256_extract_epi16(carry_vector, 0));
+    return prefixSumScalar(values + i, count - i, carry);
+}
+
+SIMD_TARGET("avx2")
+void deltaAVX2(const int16_t* values, size_t count, int16_t prev, int16_t* deltas)
+{
+    if (count == 0)
+        return;
+
+    deltas[0] = static_cast<int16_t>(values[0] - prev);
+
+    size_t i = 1;
+    for (; i + 16 <= count; i += 16) {
+        __m256i current = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        __m256i previous = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i - 1));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(deltas + i), _mm256_sub_epi16(current, previous));
+    }
+
+    deltaScalar(values + i, count - i, values[i - 1], deltas + i);
+}
+
+SIMD_TARGET("avx2")
+size_t zigzagBytesAVX2(const int16_t* deltas, size_t count, uint8_t* output)
+{
+    const __m256i low = _mm256_set1_epi16(-65);
+    const __m256i high = _mm256_set1_epi16(64);
+    size_t i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(deltas + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(deltas + i + 16));
+
+        __m256i small_a = _mm256_and_si256(_mm256_cmpgt_epi16(a, low), _mm256_cmpgt_epi16(high, a));
+        __m256i small_b = _mm256_and_si256(_mm256_cmpgt_epi16(b, low), _mm256_cmpgt_epi16(high, b));
+        if (_mm256_movemask_epi8(_mm256_packs_epi16(small_a, small_b)) != -1)
+            break;
+
+        a = _mm256_xor_si256(_mm256_slli_epi16(a, 1), _mm256_srai_epi16(a, 15));
+        b = _mm256_xor_si256(_mm256_slli_epi16(b, 1), _mm256_srai_epi16(b, 15));
+
+        // Packing works per 128 bit lane, the permute puts the bytes back in order
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), packed);
+    }
+
+    return i + zigzagBytesScalar(deltas + i, count - i, output + i);
+}
+
+SIMD_TARGET("avx2")
+size_t unzigzagBytesAVX2(const uint8_t* data, size_t count, int16_t* deltas)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+    size_t i = 0;
+
+    for (; i + 32 <= count; i += 32) {
+        __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        if (_mm256_movemask_epi8(bytes) != 0)
+            break;
+
+        __m256i a = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(bytes));
+        __m256i b = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(bytes, 1));
+        a = _mm256_xor_si256(_mm256_srli_epi16(a, 1), _mm256_sub_epi16(zero, _mm256_and_si256(a, one)));
+        b = _mm256_xor_si256(_mm256_srli_epi16(b, 1), _mm256_sub_epi16(zero, _mm256_and_si256(b, one)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(deltas + i), a);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(deltas + i + 16), b);
+    }
+
+    return i + unzigzagBytesScalar(data + i, count - i, deltas + i);
+}
+
+SIMD_TARGET("sse4.2")
+uint32_t crc32cSSE42(const uint8_t* data, size_t size, uint32_t crc)
+{
+    crc = ~crc;
+
+#if defined(__x86_64__) || defined(_M_X64)
+    uint64_t crc64 = crc;
+    for (; size >= 8; data += 8, size -= 8) {
+        uint64_t value;
+        memcpy(&value, data, sizeof(value));
+        crc64 = _mm_crc32_u64(crc64, value);
+    }
+    crc = static_cast<uint32_t>(crc64);
+#else
+    for (; size >= 4; data += 4, size -= 4) {
+        uint32_t value;
+        memcpy(&value, data, sizeof(value));
+        crc = _mm_crc32_u32(crc, value);
+    }
+#endif
+
+    for (; size > 0; data++, size--)
+        crc = _mm_crc32_u8(crc, *data);
+
+    return ~crc;
+}
+
+bool detectCrc32c()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+Simd::Level detect()
+{
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    bool avx2 = false;
+    if (max_leaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    bool sse2 = __builtin_cpu_supports("sse2");
+    bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+
+    if (avx2)
+        return Simd::LEVEL_AVX2;
+    if (sse2)
+        return Simd::LEVEL_SSE2;
+    return Simd::LEVEL_SCALAR;
+}
+
+#else
+
+Simd::Level detect()
+{
+    return Simd::LEVEL_SCALAR;
+}
+
+bool detectCrc32c()
+{
+    return false;
+}
+
+#endif
+
+const Kernels g_Kernels[] = {
+    { prefixSumScalar, deltaScalar, zigzagBytesScalar, unzigzagBytesScalar },
+#ifdef SIMD_X86
+    { prefixSumSSE2, deltaSSE2, zigzagBytesSSE2, unzigzagBytesSSE2 },
+    { prefixSumAVX2, deltaAVX2, zigzagBytesAVX2, unzigzagBytesAVX2 },
+#endif
+};
+
+const Simd::Level g_DetectedLevel = detect();
+const Kernels* g_Active = &g_Kernels[g_DetectedLevel];
+const bool g_HasCrc32c = detectCrc32c();
+
+}
+
+Simd::Level Simd::detectedLevel()
+{
+    return g_DetectedLevel;
+}
+
+Simd::Level Simd::activeLevel()
+{
+    return static_cast<Level>(g_Active - g_Kernels);
+}
+
+void Simd::setLevel(Level level)
+{
+    g_Active = &g_Kernels[level < g_DetectedLevel ? level : g_DetectedLevel];
+}
+
+const char* Simd::levelName(Level level)
+{
+    switch (level) {
+    case LEVEL_AVX2: return "AVX2";
+    case LEVEL_SSE2: return "SSE2";
+    default: return "scalar";
+    }
+}
+
+int16_t Simd::prefixSum(int16_t* values, size_t count, int16_t carry)
+{
+    return g_Active->prefixSum(values, count, carry);
+}
+
+void Simd::delta(const int16_t* values, size_t count, int16_t prev, int16_t* deltas)
+{
+    g_Active->delta(values, count, prev, deltas);
+}
+
+size_t Simd::zigzagBytes(const int16_t* deltas, size_t count, uint8_t* output)
+{
+    return g_Active->zigzagBytes(deltas, count, output);
+}
+
+size_t Simd::unzigzagBytes(const uint8_t* data, size_t count, int16_t* deltas)
+{
+    return g_Active->unzigzagBytes(data, count, deltas);
+}
+
+bool Simd::hasCrc32c()
+{
+    return g_HasCrc32c;
+}
+
+uint32_t Simd::crc32c(const uint8_t* data, size_t size, uint32_t crc)
+{
+#ifdef SIMD_X86
+    // The scalar level also forces the table version so benchmarks can compare them
+    if (g_HasCrc32c && g_Active != &g_Kernels[LEVEL_SCALAR])
+        return crc32cSSE42(data, size, crc);
+#endif
+    return crc32cScalar(data, size, crc);
+}
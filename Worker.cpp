@@ -0,0 +1,71 @@
+#include "Worker.h"
+
+void Worker::post(Job job)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    jobs.push_back(std::move(job));
+
+    // Started lazily so a stopped worker can be reused on the next map
+    if (!running) {
+        running = true;
+        thread = std::thread(&Worker::run, this);
+    }
+
+    condition.notify_one();
+}
+
+void Worker::poll()
+{
+    std::deque<Completion> finished;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (completions.empty())
+            return;
+        finished.swap(completions);
+    }
+
+    for (auto& completion : finished) {
+        if (completion)
+            completion();
+    }
+}
+
+void Worker::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running)
+            return;
+        running = false;
+    }
+    condition.notify_one();
+
+    if (thread.joinable())
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    completions.clear();
+}
+
+void Worker::run()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    for (;;) {
+        condition.wait(lock, [this] { return !jobs.empty() || !running; });
+
+        // Queued jobs are always finished before the thread exits
+        if (jobs.empty())
+            return;
+
+        Job job = std::move(jobs.front());
+        jobs.pop_front();
+
+        lock.unlock();
+        Completion completion = job();
+        lock.lock();
+
+        completions.push_back(std::move(completion));
+    }
+}
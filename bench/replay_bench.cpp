@@ -0,0 +1,388 @@
+// Standalone benchmark for the replay codec, runs without AMXX or HLDS.
+// Usage: replays_bench [frames] [iterations]
+
+#include "Replay.h"
+#include "ReplayCache.h"
+#include "Simd.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <new>
+#include <random>
+
+// Every heap allocation of the process is counted
+static std::atomic<size_t> g_allocations(0);
+
+void* operator new(size_t size)
+{
+    g_allocations++;
+    void* ptr = malloc(size ? size : 1);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+struct Result {
+    double seconds;
+    size_t allocations;
+};
+
+static Result measure(int iterations, const std::function<void()>& fn)
+{
+    fn(); // Warm up
+
+    size_t allocations = g_allocations;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < iterations; i++)
+        fn();
+
+    auto end = std::chrono::steady_clock::now();
+
+    Result result;
+    result.seconds = std::chrono::duration<double>(end - start).count() / iterations;
+    result.allocations = (g_allocations - allocations) / iterations;
+    return result;
+}
+
+static void report(const char* name, size_t frames, size_t bytes, const Result& result)
+{
+    printf("  %-34s %12.0f frames/s %8.2f bytes/frame %10zu allocs %8.3f ms\n",
+        name,
+        frames / result.seconds,
+        frames ? static_cast<double>(bytes) / frames : 0.0,
+        result.allocations,
+        result.seconds * 1000.0);
+}
+
+static Header makeHeader()
+{
+    Header header;
+    header.timestamp = 1700000000;
+    header.version = REPLAY_VERSION;
+    header.time = 1234567;
+    header.map = "bkz_goldbhop";
+    header.name = "benchmark";
+    header.steamID = "STEAM_0:1:12345678";
+    header.info = "Pro";
+    return header;
+}
+
+// Random walk where every field changes each frame, a worst case for the delta format
+static Replay makeSynthetic(size_t frames)
+{
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> small(-100, 100);
+    std::uniform_int_distribution<int> chance(0, 99);
+
+    Replay replay;
+    replay.setHeader(makeHeader());
+
+    int origin[3] = { 0, 0, 0 };
+    int angles[2] = { 0, 0 };
+    int speed = 250;
+    int keys = 0;
+
+    for (size_t i = 0; i < frames; i++) {
+        for (int axis = 0; axis < 3; axis++)
+            origin[axis] = std::max(-32000, std::min(32000, origin[axis] + small(rng) * (chance(rng) < 5 ? 10 : 1)));
+        angles[0] = std::max(-445, std::min(445, angles[0] + small(rng) / 4));
+        angles[1] += small(rng);
+        if (angles[1] > 900) angles[1] -= 1800;
+        if (angles[1] < -900) angles[1] += 1800;
+        speed = std::max(0, speed + small(rng) / 2);
+        if (chance(rng) < 20)
+            keys = chance(rng) * 37;
+
+        replay.addFrame(FrameData(16 + chance(rng) % 2, origin, angles, speed, 25, keys, chance(rng) % 8, chance(rng), chance(rng) < 50, true));
+    }
+
+    return replay;
+}
+
+// Idle start followed by strafed bunny hops, close to what PM_Move records
+static Replay makeRecorded(size_t frames)
+{
+    const int IN_JUMP = (1 << 1), IN_FORWARD = (1 << 3), IN_MOVELEFT = (1 << 9), IN_MOVERIGHT = (1 << 10);
+
+    Replay replay;
+    replay.setHeader(makeHeader());
+
+    double x = 0.0, y = 0.0, z = 36.0;
+    double yaw = 90.0;
+    double speed = 0.0;
+    size_t idle = std::min<size_t>(frames / 10, 30 * 60); // Up to 30 seconds standing at the start
+
+    for (size_t i = 0; i < frames; i++) {
+        int keys = 0;
+        bool grounded = true;
+        int strafes = 0, sync = 0;
+
+        if (i >= idle) {
+            size_t t = i - idle;
+            size_t jump = t % 45; // One jump every 0.75 seconds
+            grounded = jump < 2;
+
+            bool left = (t / 12) % 2 == 0;
+            keys = left ? IN_MOVELEFT : IN_MOVERIGHT;
+            if (jump == 0)
+                keys |= IN_JUMP | IN_FORWARD;
+
+            yaw += (left ? 1.0 : -1.0) * 1.6;
+            if (yaw > 180.0) yaw -= 360.0;
+            if (yaw < -180.0) yaw += 360.0;
+
+            speed = std::min(600.0, speed + (grounded ? -4.0 : 1.5));
+            if (speed < 250.0) speed = 250.0;
+
+            x += std::cos(yaw * M_PI / 180.0) * speed / 60.0;
+            y += std::sin(yaw * M_PI / 180.0) * speed / 60.0;
+            z = 36.0 + (grounded ? 0.0 : 45.0 * std::sin((jump - 2) * M_PI / 43.0));
+
+            if (grounded) {
+                strafes = 6;
+                sync = 85;
+            }
+        }
+
+        int origin[3] = { static_cast<int>(x * 4), static_cast<int>(y * 4), static_cast<int>(z * 4) };
+        int angles[2] = { 0, static_cast<int>(yaw * 5) };
+
+        replay.addFrame(FrameData(16, origin, angles, static_cast<int>(speed), 25, keys, strafes, sync, grounded, true));
+    }
+
+    return replay;
+}
+
+static void benchmark(const char* name, Replay& replay, int iterations)
+{
+    ReplayColumns* columns = replay.getFrames();
+    size_t frames = columns->size();
+
+    std::vector<FrameData> frameData;
+    frameData.reserve(frames);
+    for (size_t i = 0; i < frames; i++)
+        frameData.push_back(columns->at(i));
+
+    printf("%s (%zu frames)\n", name, frames);
+
+    // Per frame encoders
+    size_t bytes = 0;
+    Result result = measure(iterations, [&]() {
+        bytes = 0;
+        for (size_t i = 0; i < frames; i++)
+            bytes += frameData[i].encode().size();
+    });
+    report("FrameData::encode", frames, bytes, result);
+
+    result = measure(iterations, [&]() {
+        bytes = 0;
+        for (size_t i = 1; i < frames; i++)
+            bytes += frameData[i].encode_delta(frameData[i - 1]).size();
+    });
+    report("FrameData::encode_delta", frames - 1, bytes, result);
+
+    ByteWriter writer;
+    writer.reserve(frames * MAX_FRAME_BYTE_SIZE);
+    result = measure(iterations, [&]() {
+        writer.clear();
+        frameData[0].encode(writer);
+        for (size_t i = 1; i < frames; i++)
+            frameData[i].encode_delta(writer, frameData[i - 1]);
+    });
+    report("encode_delta (ByteWriter)", frames, writer.size(), result);
+
+    std::vector<uint8_t> stream = writer.getBuffer();
+    result = measure(iterations, [&]() {
+        size_t offset = 0;
+        FrameData prev_frame;
+        for (size_t i = 0; i < frames; i++) {
+            FrameData frame;
+            offset += frame.decode(stream.data() + offset, i == 0 ? nullptr : &prev_frame);
+            prev_frame = frame;
+        }
+    });
+    report("FrameData::decode", frames, stream.size(), result);
+
+    // Whole replays
+    ByteWriter file;
+    result = measure(iterations, [&]() {
+        file.clear();
+        replay.encode(file);
+    });
+    report("Replay::encode (memory)", frames, file.size(), result);
+
+    // SSE4.2 checksums against the table version
+    const Simd::Level crc_levels[] = { Simd::detectedLevel(), Simd::LEVEL_SCALAR };
+    for (Simd::Level level : crc_levels) {
+        Simd::setLevel(level);
+        size_t content_size;
+        DecodeError error;
+        result = measure(iterations * 10, [&]() {
+            Replay::verifyChecksums(file.data(), file.size(), content_size, error);
+        });
+        bool hardware = Simd::hasCrc32c() && level != Simd::LEVEL_SCALAR;
+        report(hardware ? "verifyChecksums (SSE4.2)" : "verifyChecksums (table)", frames, file.size(), result);
+    }
+    Simd::setLevel(Simd::detectedLevel());
+
+    ByteWriter entropy_file;
+    result = measure(iterations, [&]() {
+        entropy_file.clear();
+        replay.encode(entropy_file, REPLAY_FLAG_ENTROPY);
+    });
+    report("Replay::encode (entropy)", frames, entropy_file.size(), result);
+
+    result = measure(iterations, [&]() {
+        Replay::decode(entropy_file.data(), entropy_file.size());
+    });
+    report("Replay::decode (entropy)", frames, entropy_file.size(), result);
+
+    // Columnar kernels at every level the CPU supports
+    ByteWriter columnar_file;
+    for (int level = Simd::LEVEL_SCALAR; level <= Simd::detectedLevel(); level++) {
+        Simd::setLevel(static_cast<Simd::Level>(level));
+        std::string suffix = std::string(" (columnar, ") + Simd::levelName(Simd::activeLevel()) + ")";
+
+        result = measure(iterations, [&]() {
+            columnar_file.clear();
+            replay.encode(columnar_file, REPLAY_FLAG_COLUMNAR);
+        });
+        report(("Replay::encode" + suffix).c_str(), frames, columnar_file.size(), result);
+
+        result = measure(iterations, [&]() {
+            Replay::decode(columnar_file.data(), columnar_file.size());
+        });
+        report(("Replay::decode" + suffix).c_str(), frames, columnar_file.size(), result);
+
+        result = measure(iterations, [&]() {
+            Replay::decode(columnar_file.data(), columnar_file.size(), STREAM_ORIGIN | (1u << STREAM_KEYS));
+        });
+        report(("origin+keys" + suffix).c_str(), frames, columnar_file.size(), result);
+    }
+    Simd::setLevel(Simd::detectedLevel());
+
+    ByteWriter columnar_entropy_file;
+    result = measure(iterations, [&]() {
+        columnar_entropy_file.clear();
+        replay.encode(columnar_entropy_file, REPLAY_FLAG_COLUMNAR | REPLAY_FLAG_ENTROPY);
+    });
+    report("encode (columnar, entropy)", frames, columnar_entropy_file.size(), result);
+
+    const std::string path = "replays_bench.tmp.rpl";
+    result = measure(iterations, [&]() {
+        replay.encode(path);
+    });
+    report("Replay::encode (file)", frames, file.size(), result);
+
+    size_t decoded = 0;
+    result = measure(iterations, [&]() {
+        decoded = Replay::decode(path).size();
+    });
+    report("Replay::decode (file)", decoded, file.size(), result);
+
+    // Same file served from the decoded image cache
+    ReplayCache cache;
+    cache.decode(path);
+    size_t cached = 0;
+    result = measure(iterations, [&]() {
+        Replay replay;
+        cache.load(path, replay);
+        cached = replay.size();
+    });
+    report("ReplayCache::load (file)", cached, file.size(), result);
+    cache.invalidate(path);
+
+    FixedHeader peeked;
+    result = measure(iterations * 1000, [&]() {
+        Replay::peekHeader(path, peeked);
+    });
+    report("Replay::peekHeader (file)", 1, HEADER_BYTE_SIZE, result);
+
+    // Playback by time, one call per millisecond like a bot on a 1000 fps server.
+    // Revision 100 files are the header and the delta frames, without keyframes to seek to.
+    const std::string legacy_path = "replays_bench.legacy.tmp.rpl";
+    Header legacy_header = replay.getHeader();
+    legacy_header.version = REPLAY_VERSION_LEGACY;
+    ByteWriter legacy_file;
+    Replay::encodeHeader(legacy_header, legacy_file);
+    legacy_file.writeBytes(stream.data(), stream.size());
+    Replay::writeFile(legacy_path, legacy_file.data(), legacy_file.size());
+
+    Replay mapped = Replay::mapFile(path);
+    Replay mapped_legacy = Replay::mapFile(legacy_path);
+    Replay* timed[] = { &replay, &mapped, &mapped_legacy };
+    const char* timed_names[] = { "frameAtTime (decoded)", "frameAtTime (mapped)", "frameAtTime (mapped, legacy)" };
+    for (int i = 0; i < 3; i++) {
+        Replay& played = *timed[i];
+        played.buildTimeIndex();
+
+        size_t calls = played.duration();
+        FrameData frame;
+        float origin[3], angles[2];
+        result = measure(iterations, [&]() {
+            for (size_t time = 0; time < calls; time++)
+                played.frameAtTime(static_cast<double>(time), frame, origin, angles);
+        });
+        report(timed_names[i], calls, 0, result);
+
+        if (played.size() != frames)
+            printf("  ERROR: %s has %zu frames, expected %zu\n", timed_names[i], played.size(), frames);
+    }
+    std::remove(legacy_path.c_str());
+    std::remove(path.c_str());
+
+    if (decoded != frames)
+        printf("  ERROR: decoded %zu frames, expected %zu\n", decoded, frames);
+    if (cached != frames)
+        printf("  ERROR: cached %zu frames, expected %zu\n", cached, frames);
+
+    // Header
+    const int headerIterations = 100000;
+    Header header = replay.getHeader();
+    std::vector<uint8_t> packed_header;
+    result = measure(headerIterations, [&]() {
+        packed_header = Replay::encodeHeader(header);
+    });
+    report("Replay::encodeHeader", 1, packed_header.size(), result);
+
+    result = measure(headerIterations, [&]() {
+        header = Replay::decodeHeader(packed_header);
+    });
+    report("Replay::decodeHeader", 1, packed_header.size(), result);
+
+    FixedHeader fixed;
+    result = measure(headerIterations, [&]() {
+        Replay::parseHeader(packed_header.data(), fixed);
+    });
+    report("Replay::parseHeader", 1, packed_header.size(), result);
+
+    printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+    size_t frames = argc > 1 ? strtoul(argv[1], nullptr, 10) : 60 * 60 * 20; // 20 minutes at 60 fps
+    int iterations = argc > 2 ? atoi(argv[2]) : 5;
+
+    if (frames < 2 || iterations < 1) {
+        fprintf(stderr, "Usage: %s [frames >= 2] [iterations >= 1]\n", argv[0]);
+        return 1;
+    }
+
+    Replay synthetic = makeSynthetic(frames);
+    benchmark("Synthetic random walk", synthetic, iterations);
+
+    Replay recorded = makeRecorded(frames);
+    benchmark("Recorded-like bhop run", recorded, iterations);
+
+    return 0;
+}
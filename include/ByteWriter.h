@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Growable byte buffer the encoders append into, multi-byte values are big endian like the replay format
+class ByteWriter
+{
+	std::vector<uint8_t> buffer;
+
+public:
+	void reserve(size_t bytes) { buffer.reserve(bytes); }
+	void clear() { buffer.clear(); }
+
+	size_t size() const { return buffer.size(); }
+	const uint8_t* data() const { return buffer.data(); }
+	std::vector<uint8_t>& getBuffer() { return buffer; }
+
+	void writeU8(uint8_t value) { buffer.push_back(value); }
+
+	void writeU16(uint16_t value)
+	{
+		buffer.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+		buffer.push_back(static_cast<uint8_t>(value & 0xFF));
+	}
+
+	void writeU24(uint32_t value)
+	{
+		buffer.push_back(static_cast<uint8_t>((value >> 16) & 0xFF));
+		buffer.push_back(static_cast<uint8_t>((value >> 8) & 0xFF));
+		buffer.push_back(static_cast<uint8_t>(value & 0xFF));
+	}
+
+	void writeU32(uint32_t value)
+	{
+		writeU16(static_cast<uint16_t>(value >> 16));
+		writeU16(static_cast<uint16_t>(value & 0xFFFF));
+	}
+
+	void writeU64(uint64_t value)
+	{
+		writeU32(static_cast<uint32_t>(value >> 32));
+		writeU32(static_cast<uint32_t>(value & 0xFFFFFFFF));
+	}
+
+	// Fills in a value reserved earlier, position must already be written
+	void overwriteU32(size_t position, uint32_t value)
+	{
+		buffer[position] = static_cast<uint8_t>((value >> 24) & 0xFF);
+		buffer[position + 1] = static_cast<uint8_t>((value >> 16) & 0xFF);
+		buffer[position + 2] = static_cast<uint8_t>((value >> 8) & 0xFF);
+		buffer[position + 3] = static_cast<uint8_t>(value & 0xFF);
+	}
+
+	// Little endian base 128, 7 bits per byte with the high bit set on every byte but the last
+	void writeVarint(uint32_t value)
+	{
+		while (value >= 0x80) {
+			buffer.push_back(static_cast<uint8_t>(value | 0x80));
+			value >>= 7;
+		}
+		buffer.push_back(static_cast<uint8_t>(value));
+	}
+
+	void writeBytes(const void* bytes, size_t length)
+	{
+		const uint8_t* begin = static_cast<const uint8_t*>(bytes);
+		buffer.insert(buffer.end(), begin, begin + length);
+	}
+};
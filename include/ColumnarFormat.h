@@ -0,0 +1,41 @@
+#pragma once
+#include "ReplayColumns.h"
+
+// Field streams of the columnar layout, the stream id is also its bit in a stream mask
+enum ReplayStream : uint8_t
+{
+	STREAM_TIMESTAMP = 0,
+	STREAM_ORIGIN_X,
+	STREAM_ORIGIN_Y,
+	STREAM_ORIGIN_Z,
+	STREAM_ANGLE_PITCH,
+	STREAM_ANGLE_YAW,
+	STREAM_SPEED,
+	STREAM_KEYS,
+	STREAM_FPS,
+	STREAM_STRAFES,
+	STREAM_SYNC,
+	STREAM_STATE,
+	STREAM_COUNT
+};
+
+constexpr uint32_t STREAM_ALL = (1u << STREAM_COUNT) - 1;
+constexpr uint32_t STREAM_ORIGIN = (1u << STREAM_ORIGIN_X) | (1u << STREAM_ORIGIN_Y) | (1u << STREAM_ORIGIN_Z);
+constexpr uint32_t STREAM_ANGLES = (1u << STREAM_ANGLE_PITCH) | (1u << STREAM_ANGLE_YAW);
+
+constexpr auto COLUMNAR_FRAME_COUNT_BYTE_SIZE = 4;
+constexpr auto COLUMNAR_STREAM_COUNT_BYTE_SIZE = 1;
+constexpr auto COLUMNAR_DIRECTORY_ENTRY_BYTE_SIZE = 9;   // stream id (1), offset (4), length (4)
+
+// Body of a REPLAY_FLAG_COLUMNAR replay: frame count, stream directory, then one contiguous stream per field.
+// Origin, angles and speed are zigzag varint deltas from the previous frame, wrapping like int16_t.
+// The byte fields are stored as is.
+// Directory offsets are relative to the start of the body.
+class ColumnarFormat
+{
+public:
+	static void encode(const ReplayColumns& frames, ByteWriter& writer);
+	// Only the streams selected by stream_mask are decoded, the other fields are left at zero.
+	// Returns false when the body is truncated or a stream doesn't match the frame count.
+	static bool decode(const uint8_t* body, size_t size, ReplayColumns& frames, uint32_t stream_mask = STREAM_ALL);
+};
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "ByteWriter.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Saturated probabilities code a byte in about 0.18 bits, no valid stream decodes to more than 46 bytes per input byte
+constexpr auto MAX_ENTROPY_RATIO = 64;
+
+// Adaptive binary range coder with an order-1 context (the previous byte).
+// Used as an optional stage over the encoded frame stream, see REPLAY_FLAG_ENTROPY.
+class EntropyCoder
+{
+public:
+	static void encode(const uint8_t* data, size_t size, ByteWriter& writer);
+	// Decodes exactly decoded_size bytes, returns false when the input is truncated or corrupted.
+	// Stops at the first byte read past the input, a size above MAX_ENTROPY_RATIO times the input is rejected up front.
+	static bool decode(const uint8_t* data, size_t size, size_t decoded_size, std::vector<uint8_t>& output);
+};
@@ -2,11 +2,14 @@
 
 #include <string>
 #include <cstdint>
+#include <cstdio>
 #include <bitset>
 #include <vector>
 #include <algorithm>
 #include <stdexcept>
 
+#include "ByteWriter.h"
+
 constexpr auto HEADER_TIMESTAMP_BYTE_SIZE = 8;
 constexpr auto HEADER_VERSION_BYTE_SIZE = 2;
 constexpr auto HEADER_MAP_BYTE_SIZE = 32;
@@ -14,6 +17,7 @@ constexpr auto HEADER_TIME_BYTE_SIZE = 24;
 constexpr auto HEADER_NAME_BYTE_SIZE = 32;
 constexpr auto HEADER_STEAMID_BYTE_SIZE = 24;
 constexpr auto HEADER_INFO_BYTE_SIZE = 32;
+constexpr auto HEADER_RATE_BYTE_SIZE = 2;           // Taken from the end of the info field since REPLAY_VERSION_RATE
 
 
 constexpr auto FRAME_FLAGS_BYTE_SIZE = 3;
@@ -34,6 +38,32 @@ constexpr auto FPS_BYTE_SIZE = 1;
 constexpr auto STRAFES_BYTE_SIZE = 1;
 constexpr auto SYNC_BYTE_SIZE = 1;
 
+// Largest encoded frame, a keyframe or a delta frame with every field at full size
+constexpr auto MAX_FRAME_BYTE_SIZE = 20;
+
+// Record flags of the run-length frame stream (REPLAY_VERSION_RUNS), written as a varint.
+// The bits set by an ordinary frame come first so most records need a single flag byte.
+constexpr auto RECORD_REPEAT		= (1 << 0);  // Followed by a varint count of frames equal to the previous one
+constexpr auto RECORD_GROUNDED		= (1 << 1);
+constexpr auto RECORD_GRAVITY		= (1 << 2);
+constexpr auto RECORD_KEYS			= (1 << 3);
+constexpr auto RECORD_ORIGIN_X		= (1 << 4);  // Origin and angle bits select a full 2 byte delta
+constexpr auto RECORD_ORIGIN_Y		= (1 << 5);
+constexpr auto RECORD_ORIGIN_Z		= (1 << 6);
+constexpr auto RECORD_ANGLE_PITCH	= (1 << 7);
+constexpr auto RECORD_ANGLE_YAW		= (1 << 8);
+constexpr auto RECORD_SPEED			= (1 << 9);
+constexpr auto RECORD_FPS			= (1 << 10);
+constexpr auto RECORD_STRAFES		= (1 << 11);
+constexpr auto RECORD_SYNC			= (1 << 12);
+constexpr auto RECORD_FLAGS_MASK	= (1 << 13) - 1;
+
+constexpr auto MAX_VARINT_BYTE_SIZE = 5;
+// Largest record, a keyframe with a two byte flag varint
+constexpr auto MAX_RECORD_BYTE_SIZE = MAX_FRAME_BYTE_SIZE - FRAME_FLAGS_BYTE_SIZE + 2;
+// Most bytes decode_record can read, even from a damaged record with a five byte flag varint
+constexpr auto MAX_RECORD_READ_BYTE_SIZE = MAX_FRAME_BYTE_SIZE - FRAME_FLAGS_BYTE_SIZE + MAX_VARINT_BYTE_SIZE;
+
 
 constexpr auto JUMP			= (1 << 0);
 constexpr auto DUCK			= (1 << 1);
@@ -58,6 +88,11 @@ class FrameData
 	int sync;
 
 public:
+	FrameData()
+	: timestamp(0), origin{ 0, 0, 0 }, angles{ 0, 0 }, speed(0), fps(0), keys(0), grounded(false), gravity(false), strafes(0), sync(0)
+	{
+	}
+
 	FrameData(int timestamp, int origin[3], int angles[2], int speed, int fps, int keys, int strafes, int sync, bool grounded, bool gravity)
     : timestamp(timestamp), speed(speed), fps(fps), keys(keys), grounded(grounded), gravity(gravity), strafes(strafes), sync(sync)
 	{
@@ -73,7 +108,35 @@ public:
 	
 	std::vector<uint8_t> encode();
 	std::vector<uint8_t> encode_delta(FrameData prev_frame);
+	// Append the encoded frame to writer without allocating per frame
+	void encode(ByteWriter& writer) const;
+	void encode_delta(ByteWriter& writer, const FrameData& prev_frame) const;
 	int decode(const std::vector<uint8_t>& packed_data, FrameData* prev_frame = nullptr);
+	// Decodes a single frame in place from packed_data, returns the number of bytes consumed
+	int decode(const uint8_t* packed_data, const FrameData* prev_frame = nullptr);
+	// Returns the encoded size of the frame at packed_data from its flags, without decoding it
+	static int frameSize(const uint8_t* packed_data, bool first_frame);
+	// Same with one bounds check, 0 when the frame doesn't fit in available bytes
+	static size_t frameSize(const uint8_t* packed_data, size_t available, bool first_frame);
+
+	// Run-length records, prev_frame is nullptr for keyframes
+	void encode_record(ByteWriter& writer, const FrameData* prev_frame) const;
+	static void encode_repeat(ByteWriter& writer, uint32_t count);
+	// Decodes one record in place, frames receives how many frames it stands for (the repeat count of a run).
+	// Returns the number of bytes consumed.
+	int decode_record(const uint8_t* packed_data, const FrameData* prev_frame, uint32_t& frames);
+	// Exact encoded size of the record at packed_data from its flag varint, 0 when it doesn't fit in available
+	// bytes or has unknown flags. A record that passes can be decoded by decode_record without further checks.
+	static size_t recordSize(const uint8_t* packed_data, size_t available, bool keyframe);
+
+	bool operator==(const FrameData& other) const
+	{
+		return timestamp == other.timestamp && origin[0] == other.origin[0] && origin[1] == other.origin[1] &&
+			origin[2] == other.origin[2] && angles[0] == other.angles[0] && angles[1] == other.angles[1] &&
+			speed == other.speed && fps == other.fps && keys == other.keys && grounded == other.grounded &&
+			gravity == other.gravity && strafes == other.strafes && sync == other.sync;
+	}
+	bool operator!=(const FrameData& other) const { return !(*this == other); }
 
 	int getTimestamp() const { return timestamp; }
     const int* getOrigin() const { return origin; } // Returns a pointer to the array
@@ -103,7 +166,8 @@ public:
 	}
 	bool overlap() const
 	{
-		return (keys & MOVELEFT && keys & MOVERIGHT);
+		int compact_keys = convertKeys(keys);
+		return (compact_keys & MOVELEFT && compact_keys & MOVERIGHT);
 	}
 
 	FrameData operator+(const FrameData& other) const {
@@ -131,8 +195,21 @@ public:
 		return FrameData(new_timestamp, new_origin, new_angles, new_speed, new_fps, new_keys,new_strafes, new_sync, new_grounded, new_gravity);
 	}
 
-private:
-	int convertKeys(int original_keys) {
+	// Blends two stored angles along the shorter way around, the result stays within [-900, 900]
+	static float interpolate_angle(int from, int to, float fraction)
+	{
+		float angle = from + calc_angle_delta(to, from) * fraction;
+
+		if (angle > 900.0f)
+			angle -= 1800.0f;
+		else if (angle < -900.0f)
+			angle += 1800.0f;
+
+		return angle;
+	}
+
+	// Maps the engine IN_* buttons to the 8 bit layout stored in replays (JUMP, DUCK, ...)
+	static int convertKeys(int original_keys) {
 		int compact_keys = 0;
 
 		if (original_keys & (1 << 1)) compact_keys |= (1 << 0); // IN_JUMP -> compact bit 0
@@ -147,7 +224,7 @@ private:
 		return compact_keys;
 	}
 
-	int decompactKeys(int compact_keys) {
+	static int decompactKeys(int compact_keys) {
     	int original_keys = 0;
 
     	if (compact_keys & (1 << 0)) original_keys |= (1 << 1);  // Compact bit 0 -> IN_JUMP
@@ -162,8 +239,7 @@ private:
     	return original_keys;
 	}
 
-
-
+	// Angles wrap at half a turn either way, a delta is always the shortest way round
 	static int clamp_angle(int angle)
 	{
 		if (angle > 900)
@@ -185,4 +261,28 @@ private:
 			
 		return delta;
 	}
+
+private:
+	// Length of the varint at packed_data, 0 when it isn't terminated within available bytes
+	static size_t varintSize(const uint8_t* packed_data, size_t available)
+	{
+		size_t limit = std::min<size_t>(available, MAX_VARINT_BYTE_SIZE);
+		for (size_t i = 0; i < limit; i++) {
+			if (!(packed_data[i] & 0x80))
+				return i + 1;
+		}
+		return 0;
+	}
+
+	static uint32_t readVarint(const uint8_t* packed_data, size_t& offset)
+	{
+		uint32_t value = 0;
+		for (int i = 0; i < MAX_VARINT_BYTE_SIZE; i++) {
+			uint8_t byte = packed_data[offset++];
+			value |= static_cast<uint32_t>(byte & 0x7F) << (7 * i);
+			if (!(byte & 0x80))
+				break;
+		}
+		return value;
+	}
 };
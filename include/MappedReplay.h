@@ -0,0 +1,63 @@
+#pragma once
+#include "Replay.h"
+
+#include <memory>
+
+// Read-only memory mapped replay file, frames are decoded only when they are requested.
+// Entropy coded replays can't be read in place, their body is decoded once when the file is opened.
+// Columnar replays have no per frame records, all their frames are decoded when the file is opened.
+class MappedReplay
+{
+	const uint8_t* data = nullptr;
+	size_t length = 0;
+#ifdef _WIN32
+	void* file_handle = nullptr;
+	void* mapping_handle = nullptr;
+#endif
+
+	// Frames are read from the mapping, or from the decoded image of an entropy coded replay
+	std::vector<uint8_t> image;
+	const uint8_t* stream = nullptr;
+	size_t stream_length = 0;
+
+	Header header;
+	KeyframeIndex index;
+	size_t frames_offset = 0;
+	size_t frame_count = 0;
+	ReplayColumns columns;           // Decoded frames of a columnar replay
+	bool columnar = false;
+
+	// Playback cursor, sequential reads only decode one frame each
+	FrameData current;
+	size_t current_index = 0;
+	size_t next_offset = 0;
+	bool has_current = false;
+	FrameData previous;              // Frame before the cursor, interpolation reads it right after current
+	bool has_previous = false;
+	bool records = false;            // Run-length records (REPLAY_VERSION_RUNS) instead of one encoded frame each
+	uint32_t run_remaining = 0;      // Frames of the current repeat run not yet stepped over
+
+	MappedReplay() = default;
+	bool map(const std::string& input_filename);
+	void rewind();
+	void seekKeyframe(size_t keyframe);
+	void step();
+	// Size of the frame at next_offset, 0 when it is damaged or runs past the frame stream
+	size_t frameSize(bool keyframe) const;
+
+public:
+	MappedReplay(const MappedReplay&) = delete;
+	MappedReplay& operator=(const MappedReplay&) = delete;
+	~MappedReplay();
+
+	// Returns nullptr and fills error when the file is missing or damaged
+	static std::shared_ptr<MappedReplay> open(const std::string& input_filename, DecodeError& error);
+
+	const Header& getHeader() const { return header; }
+	size_t size() const { return frame_count; }
+
+	// Decodes from the cursor or from the closest keyframe, at most one keyframe interval per call.
+	// The frame before the cursor is kept, anything further back restarts from the first frame
+	// in legacy replays without keyframes.
+	FrameData getFrame(size_t frame);
+};
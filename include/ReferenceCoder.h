@@ -0,0 +1,25 @@
+#pragma once
+#include "ReplayColumns.h"
+
+#include <cstddef>
+#include <cstdint>
+
+constexpr auto REFERENCE_SEARCH_WINDOW = 64;         // Reference frames searched on each side of the previous match
+
+// Residuals of a run against a reference run of the same route, see REPLAY_FLAG_REFERENCE.
+// Every frame is matched to the nearest reference frame, searched around the previous match, and its origin
+// and angles are stored as the difference to that frame. Origins wrap like int16_t, angles like frame deltas.
+// The other fields are kept as recorded. The matches are stored separately as runs of equal steps.
+// Close runs leave small, steady residuals that only pay off with REPLAY_FLAG_ENTROPY.
+class ReferenceCoder
+{
+public:
+	// FNV-1a of every column, the same frames always give the same hash whatever the file layout they were decoded from
+	static uint64_t contentHash(const ReplayColumns& frames);
+
+	// Fills residuals with the frames relative to their matches and appends the match runs to alignment
+	static void encode(const ReplayColumns& frames, const ReplayColumns& reference, ReplayColumns& residuals, ByteWriter& alignment);
+	// Adds the matched reference frames back to the residuals in place.
+	// Returns false when the runs don't cover the frames or step outside the reference.
+	static bool decode(const uint8_t* alignment, size_t size, const ReplayColumns& reference, ReplayColumns& frames);
+};
@@ -1,5 +1,52 @@
 #pragma once
 #include "Frame.h"
+#include "ReplayColumns.h"
+#include "ColumnarFormat.h"
+
+#include <memory>
+
+class MappedReplay;
+class ReplayCursor;
+
+// The low 12 bits of Header::version are the format revision, the high 4 bits are optional REPLAY_FLAG_* stages
+constexpr uint16_t REPLAY_VERSION_LEGACY = 100;     // Delta frames only
+constexpr uint16_t REPLAY_VERSION_KEYFRAMES = 101;  // Periodic absolute frames and a keyframe index trailer
+constexpr uint16_t REPLAY_VERSION_RUNS = 102;       // Varint record flags and repeat counts for runs of identical frames
+constexpr uint16_t REPLAY_VERSION_CHECKSUM = 103;   // CRC32C of every block of the stored file in a trailer
+constexpr uint16_t REPLAY_VERSION_RATE = 104;       // Recording rate in the last two bytes of the info field
+constexpr uint16_t REPLAY_VERSION = REPLAY_VERSION_RATE;
+
+constexpr uint16_t REPLAY_REVISION_MASK = 0x0FFF;
+constexpr uint16_t REPLAY_FLAG_ENTROPY = 0x1000;    // Everything after the header is entropy coded, see EntropyCoder
+constexpr uint16_t REPLAY_FLAG_COLUMNAR = 0x2000;   // One delta stream per field instead of frame records, see ColumnarFormat
+constexpr uint16_t REPLAY_FLAG_REFERENCE = 0x4000;  // Origins and angles relative to another replay of the route, see ReferenceCoder
+
+constexpr auto ENTROPY_SIZE_BYTE_SIZE = 4;          // Decoded size of the body, stored before the coded data
+constexpr auto MAX_BODY_BYTE_SIZE = 64 * 1024 * 1024;  // Hours of frames, larger sizes only come from damaged files
+
+inline uint16_t replayRevision(uint16_t version) { return version & REPLAY_REVISION_MASK; }
+
+constexpr auto HEADER_BYTE_SIZE = 133;
+
+// Frames per second of replays older than REPLAY_VERSION_RATE
+constexpr uint16_t DEFAULT_RECORD_RATE = 60;
+
+constexpr auto KEYFRAME_INTERVAL = 256;
+constexpr auto KEYFRAME_OFFSET_BYTE_SIZE = 4;
+constexpr auto KEYFRAME_TRAILER_BYTE_SIZE = 14;       // frame count (4), interval (2), keyframe count (4), magic (4)
+constexpr uint32_t KEYFRAME_TRAILER_MAGIC = 0x524B4958; // "RKIX"
+
+// The checksum trailer follows everything else, including the entropy coded body
+constexpr auto CHECKSUM_BLOCK_BYTE_SIZE = 65536;
+constexpr auto CHECKSUM_BYTE_SIZE = 4;
+constexpr auto CHECKSUM_TRAILER_BYTE_SIZE = 12;       // block size (4), block count (4), magic (4)
+constexpr uint32_t CHECKSUM_TRAILER_MAGIC = 0x52435243; // "RCRC"
+
+// The reference trailer ends the body of a REPLAY_FLAG_REFERENCE replay, after the frames and their own trailers.
+// The alignment runs come first, decoding needs the replay whose content hash is stored here.
+constexpr auto REFERENCE_TRAILER_BYTE_SIZE = 16;      // reference hash (8), alignment size (4), magic (4)
+constexpr uint32_t REFERENCE_TRAILER_MAGIC = 0x52524546; // "RREF"
+constexpr auto MAX_REFERENCE_DEPTH = 8;               // References of references followed when decoding
 
 struct Header {
 	uint64_t timestamp;       // 8 bytes
@@ -8,51 +55,152 @@ struct Header {
 	std::string map;          // 32 bytes
 	std::string name;         // 32 bytes
 	std::string steamID;      // 24 bytes
-	std::string info;         // 32 bytes
+	std::string info;         // 32 bytes, 30 since REPLAY_VERSION_RATE
+	uint16_t rate = DEFAULT_RECORD_RATE; // 2 bytes, frames recorded per second
+};
+
+// Header fields at their on-disk sizes, filled without allocating. Strings are null terminated.
+struct FixedHeader {
+	uint64_t timestamp;
+	uint16_t version;
+	uint32_t time;
+	char map[HEADER_MAP_BYTE_SIZE + 1];
+	char name[HEADER_NAME_BYTE_SIZE + 1];
+	char steamID[HEADER_STEAMID_BYTE_SIZE + 1];
+	char info[HEADER_INFO_BYTE_SIZE + 1];
+	uint16_t rate;
+};
+
+enum DecodeStatus {
+	DECODE_OK = 0,
+	DECODE_UNREADABLE,          // The file can't be opened or read
+	DECODE_TRUNCATED,           // Shorter than its header or trailers say
+	DECODE_INVALID_TRAILER,
+	DECODE_CHECKSUM_MISMATCH,
+	DECODE_INVALID_DATA,
+	DECODE_MISSING_REFERENCE    // Encoded against a replay that wasn't given or found
+};
+
+// Why a replay couldn't be decoded, offset is the byte of the stored file where it was noticed.
+// Frame offsets of an entropy coded replay point into its decoded image.
+struct DecodeError {
+	DecodeStatus status = DECODE_OK;
+	size_t offset = 0;
+
+	std::string message() const;
+};
+
+// Keyframe index stored at the end of the file, offsets point at absolute frames
+struct KeyframeIndex {
+	uint32_t frame_count = 0;
+	uint16_t interval = 0;              // 0 when the replay has no keyframes
+	std::vector<uint32_t> offsets;
+	size_t frames_end = 0;              // First byte after the frame stream
 };
 
 class Replay {
 	Header header;
-	std::vector<FrameData> frames;
+	ReplayColumns frames;
+	std::shared_ptr<MappedReplay> mapped; // Set when the frames are read lazily from a mapped file
+	DecodeError error;
+	uint64_t reference_hash = 0;          // Content hash of the reference of a REPLAY_FLAG_REFERENCE replay
+	std::vector<uint32_t> time_index;     // Milliseconds elapsed at the end of every frame, see buildTimeIndex
 
 public:
-	void encode(const std::string& output_filename);
-	static Replay decode(const std::string& input_filename);
+	// format_flags selects the optional REPLAY_FLAG_* stages, REPLAY_FLAG_REFERENCE is set when a decoded reference is given
+	bool encode(const std::string& output_filename, uint16_t format_flags = 0, const Replay* reference = nullptr) const;
+	// Appends the whole encoded file to writer
+	void encode(ByteWriter& writer, uint16_t format_flags = 0, const Replay* reference = nullptr) const;
+	// Columnar replays only decode the streams selected by stream_mask, other layouts always decode every field.
+	// REPLAY_FLAG_REFERENCE replays need their reference, see ReplayCatalog::decodeFile to find it.
+	static Replay decode(const std::string& input_filename, uint32_t stream_mask = STREAM_ALL, const Replay* reference = nullptr);
+	static Replay decode(const uint8_t* data, size_t size, uint32_t stream_mask = STREAM_ALL, const Replay* reference = nullptr);
+	// Maps the file instead of decoding it, frames are decoded on demand by getFrame
+	static Replay mapFile(const std::string& input_filename);
 	
 	static std::vector<uint8_t> encodeHeader(const Header& header);
+	static void encodeHeader(const Header& header, ByteWriter& writer);
 	static Header decodeHeader(const std::vector<uint8_t>& packed_header);
+	// data must hold at least HEADER_BYTE_SIZE bytes
+	static Header decodeHeader(const uint8_t* data);
+	static void parseHeader(const uint8_t* data, FixedHeader& header);
+	// Reads only the header bytes of a replay file
+	static bool peekHeader(const std::string& input_filename, FixedHeader& header);
+
+	static bool readFile(const std::string& input_filename, std::vector<uint8_t>& buffer);
+	// Writes data to a temporary file and renames it over output_filename
+	static bool writeFile(const std::string& output_filename, const uint8_t* data, size_t size);
+	// Size and Unix time of the last write, false when the file doesn't exist
+	static bool fileInfo(const std::string& filename, uint64_t& size, int64_t& modified);
+
+	// Rebuilds the plain file image (header and decoded body) of an entropy coded replay
+	static bool decodeEntropy(const uint8_t* data, size_t size, std::vector<uint8_t>& image);
+
+	// Checks the CRC32C trailer of a stored file and returns the size without it.
+	// Replays older than REPLAY_VERSION_CHECKSUM have no trailer and always pass.
+	static bool verifyChecksums(const uint8_t* data, size_t size, size_t& content_size, DecodeError& error);
+
+	// Reads the reference trailer of a plain file image, size becomes the end of the frames and alignment the start of the runs
+	static bool decodeReferenceTrailer(const uint8_t* data, size_t& size, uint64_t& reference_hash, size_t& alignment);
+
+	// Reads the keyframe index of a whole file buffer, legacy and columnar replays get an index without keyframes
+	static bool decodeKeyframeIndex(const uint8_t* data, size_t size, uint16_t version, KeyframeIndex& index);
 
 	Header getHeader() { return header; }
 	void setHeader(Header header) { this->header = header; }
-	std::vector<FrameData>* getFrames() { return &frames; }
+	ReplayColumns* getFrames() { return &frames; }
+
+	// Work for both decoded and mapped replays
+	size_t size() const;
+	FrameData getFrame(size_t index) const;
+	bool isMapped() const { return mapped != nullptr; }
+	// Set by decode and mapFile when the replay has no frames because the file is damaged
+	const DecodeError& getError() const { return error; }
+	// Content hash of the replay needed to decode this one, 0 unless it is REPLAY_FLAG_REFERENCE
+	uint64_t getReferenceHash() const { return reference_hash; }
+	// Identifies the frames for reference encoding, see ReferenceCoder::contentHash
+	uint64_t contentHash() const;
 
 
 	void print() const
 	{
-		printf("\nTimestamp: %llu\nVersion: %u\nTime: %u\nMap: %s\nName: %s\nSteamID: %s\nINFO: %s\n\n",
+		printf("\nTimestamp: %llu\nVersion: %u\nTime: %u\nMap: %s\nName: %s\nSteamID: %s\nINFO: %s\nRate: %u\n\n",
 			header.timestamp,
 			header.version,
 			header.time,
 			header.map.c_str(),
 			header.name.c_str(),
 			header.steamID.c_str(),
-			header.info.c_str());
+			header.info.c_str(),
+			header.rate);
 
 	}
 	void printFrames() const
 	{
 		for (size_t i = 0; i < frames.size(); i++)
-			frames[i].print();
+			frames.at(i).print();
 	}
-	uint16_t overlap() const
-	{
-		uint16_t overlaps = 0;
-		for (size_t i = 0; i < frames.size(); i++)
-			if (frames[i].overlap())
-				overlaps++;
+	uint16_t overlap() const;
 
-		return overlaps;
-	}
+	// Sums the frame timestamps once so frameAtTime is a binary search, rebuild after adding frames
+	void buildTimeIndex();
+	bool hasTimeIndex() const { return time_index.size() == size(); }
+	// Total length in milliseconds, 0 without a time index
+	uint32_t duration() const;
+	// Blends origin and angles of the two frames around time (milliseconds), in the stored units (origin * 4, angles * 5).
+	// frame gets the earlier of the two, times outside the replay return the first or last frame.
+	// Frames of a mapped replay are read through cursor when one is given, see ReplayCursor::frameAt.
+	bool frameAtTime(double time, FrameData& frame, float origin[3], float angles[2], ReplayCursor* cursor = nullptr) const;
 
 	void addFrame(const FrameData frame);
+
+private:
+	// Appends everything after the header in the layout selected by format_flags
+	void encodeBody(ByteWriter& writer, size_t start, uint16_t format_flags, const Replay* reference) const;
+	// Decodes the frames of a plain file image that ends with the last frame trailer
+	void decodeBody(const uint8_t* data, size_t size, uint32_t stream_mask);
+	// Appends the frames and the keyframe index, offsets are relative to start
+	void encodeFrames(ByteWriter& writer, size_t start) const;
+	// Appends the checksum of every block written since start
+	static void encodeChecksums(ByteWriter& writer, size_t start);
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+#pragma once
+#include "Replay.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+
+constexpr uint32_t CACHE_MAGIC = 0x52444349;        // "RDCI"
+constexpr uint16_t CACHE_VERSION = 1;
+constexpr auto CACHE_HEADER_BYTE_SIZE = 10;          // magic (4), version (2), frame count (4)
+constexpr auto CACHE_FRAME_BYTE_SIZE = 18;           // One FrameChunk column entry per field
+constexpr auto CACHE_EXTENSION = ".rdc";
+constexpr uint64_t CACHE_DEFAULT_BUDGET = 256ull * 1024 * 1024;
+
+// Decoded replays kept outside the module so they survive map changes and module reloads.
+// Each replay is stored as a raw image of its columns in a tmpfs directory, keyed by path, size and mtime,
+// so a hit is a file read and a few memcpy calls. The least recently used images are evicted over the budget.
+class ReplayCache
+{
+	std::string directory;
+	std::atomic<uint64_t> budget{ CACHE_DEFAULT_BUDGET };
+	std::mutex mutex;
+
+public:
+	// An empty directory picks /dev/shm on Linux and the temporary directory elsewhere
+	explicit ReplayCache(const std::string& directory = "");
+
+	const std::string& getDirectory() const { return directory; }
+	uint64_t getBudget() const { return budget; }
+	// 0 disables the cache and deletes every image
+	void setBudget(uint64_t bytes);
+
+	// Returns the cached replay when the file hasn't changed, decodes and caches the file otherwise.
+	// A miss writes the image and evicts on the calling thread, the game thread stores on the worker instead.
+	Replay decode(const std::string& path);
+
+	bool load(const std::string& path, Replay& replay);
+	// Writes the image of a replay just decoded from or encoded to path, false when it doesn't fit the budget
+	bool store(const std::string& path, Replay& replay);
+	// Drops every image of path, called when the replay is overwritten
+	void invalidate(const std::string& path);
+	void clear();
+
+	// Total size of the cached images
+	uint64_t usage();
+
+private:
+	// Images of the same path share the prefix, the suffix identifies the file version
+	static std::string keyPrefix(const std::string& path);
+	bool imagePath(const std::string& path, std::string& image_path) const;
+	// Deletes the oldest images until the cache fits the budget, the caller holds mutex
+	void evict();
+};
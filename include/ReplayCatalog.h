@@ -0,0 +1,97 @@
+#pragma once
+#include "Replay.h"
+
+#include <string>
+#include <vector>
+
+constexpr auto CATALOG_FILENAME = "replays.catalog";
+constexpr uint32_t CATALOG_MAGIC = 0x52434154;      // "RCAT"
+constexpr uint16_t CATALOG_VERSION = 3;             // Older catalogs have no content or reference hashes and are rebuilt
+constexpr auto CATALOG_HEADER_BYTE_SIZE = 12;        // magic (4), version (2), entry size (2), entry count (4)
+constexpr auto CATALOG_FILE_BYTE_SIZE = 128;
+constexpr auto CATALOG_ENTRY_BYTE_SIZE = CATALOG_FILE_BYTE_SIZE + HEADER_BYTE_SIZE + 46;
+
+// One replay of a directory, enough to list and filter replays without opening them
+struct CatalogEntry {
+	char file[CATALOG_FILE_BYTE_SIZE + 1];  // Name inside the directory
+	uint8_t packed_header[HEADER_BYTE_SIZE];
+	FixedHeader header;
+	uint32_t frames;
+	uint64_t size;
+	int64_t modified;                       // Unix time of the last write
+	uint32_t duration;                      // Sum of the frame timestamps in milliseconds
+	uint16_t max_speed;
+	uint16_t avg_speed;
+	uint16_t overlaps;
+	uint64_t content_hash;                  // What REPLAY_FLAG_REFERENCE replays of the directory refer to
+	uint64_t reference_hash;                // Content hash of the reference of a REPLAY_FLAG_REFERENCE replay, 0 otherwise
+};
+
+enum CatalogSort {
+	CATALOG_SORT_NONE = 0,
+	CATALOG_SORT_TIME,          // Fastest run first
+	CATALOG_SORT_DATE,          // Newest replay first
+	CATALOG_SORT_NAME
+};
+
+// Empty fields match everything
+struct CatalogFilter {
+	std::string map;
+	std::string steamID;
+	std::string info;
+};
+
+// Index of the replays of one directory, stored in CATALOG_FILENAME next to them.
+// The module updates it on every save, replaytool catalog rebuilds it offline.
+class ReplayCatalog
+{
+	std::string directory;
+	std::vector<CatalogEntry> entries;
+	bool pending = false;           // Empty until the module's worker has rebuilt it
+
+public:
+	ReplayCatalog() = default;
+	explicit ReplayCatalog(const std::string& directory) : directory(directory) {}
+
+	const std::string& getDirectory() const { return directory; }
+	size_t size() const { return entries.size(); }
+	const CatalogEntry& at(size_t index) const { return entries.at(index); }
+	bool isPending() const { return pending; }
+	void setPending(bool value) { pending = value; }
+
+	// Reads the catalog file of the directory, false when it is missing or damaged
+	bool load();
+	// Writes the catalog file atomically
+	bool save() const;
+	// Scans every replay of the directory, each one is fully decoded
+	void rebuild();
+
+	// Replaces the entry of the same file or adds it
+	void update(const CatalogEntry& entry);
+	bool remove(const std::string& file);
+
+	// Returns the indexes of the matching entries in the requested order
+	std::vector<size_t> find(const CatalogFilter& filter, CatalogSort sort) const;
+	// Entry of the replay with these frames, nullptr when there is none
+	const CatalogEntry* findContent(uint64_t content_hash) const;
+	// Call before the file is overwritten with frames of content_hash. When other replays of the directory
+	// refer to its current frames, the file and its entry are renamed to <file>.<content hash> so they keep
+	// decoding, kept is set to the renamed entry. False when the file can't be renamed.
+	bool keepReferenced(const std::string& file, uint64_t content_hash, CatalogEntry& kept);
+
+	// Decodes a replay of the directory, the reference of a REPLAY_FLAG_REFERENCE replay is found by its content hash.
+	// References of references are followed up to MAX_REFERENCE_DEPTH.
+	Replay decode(const std::string& path, int depth = 0) const;
+	// Decodes a replay file, the catalog of its directory is only loaded for a REPLAY_FLAG_REFERENCE replay
+	static Replay decodeFile(const std::string& path);
+
+	// Fills an entry from a decoded replay and the file it was written to
+	static bool describe(const std::string& path, Replay& replay, CatalogEntry& entry);
+	// Reads and decodes the replay file first, references are found in catalog or in the catalog file of the directory
+	static bool describe(const std::string& path, CatalogEntry& entry, const ReplayCatalog* catalog = nullptr);
+
+	static std::string directoryOf(const std::string& path);
+	static std::string fileOf(const std::string& path);
+	// Catalog and temporary files are skipped
+	static bool isReplayFile(const std::string& file);
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include "Frame.h"
+
+#include <memory>
+
+constexpr auto FRAME_STATE_GROUNDED = (1 << 0);
+constexpr auto FRAME_STATE_GRAVITY = (1 << 1);
+
+constexpr auto FRAMES_PER_CHUNK = 4096; // ~68 seconds at 60 fps
+
+// Fixed size block of frames, one packed array per field
+struct FrameChunk
+{
+	uint8_t timestamp[FRAMES_PER_CHUNK];
+	int16_t origin[3][FRAMES_PER_CHUNK];
+	int16_t angles[2][FRAMES_PER_CHUNK];
+	int16_t speed[FRAMES_PER_CHUNK];
+	uint8_t fps[FRAMES_PER_CHUNK];
+	uint8_t keys[FRAMES_PER_CHUNK];      // Compact layout, see FrameData::convertKeys
+	uint8_t strafes[FRAMES_PER_CHUNK];
+	uint8_t sync[FRAMES_PER_CHUNK];
+	uint8_t state[FRAMES_PER_CHUNK];     // FRAME_STATE_* bits
+};
+
+// Columnar frame storage kept in a list of fixed size chunks, appending never moves recorded frames.
+// Values are stored with the same widths as the replay format (18 bytes per frame).
+class ReplayColumns
+{
+	std::vector<std::unique_ptr<FrameChunk>> chunks;
+	size_t count = 0;
+
+public:
+	ReplayColumns() = default;
+	ReplayColumns(const ReplayColumns& other);
+	ReplayColumns& operator=(const ReplayColumns& other);
+	ReplayColumns(ReplayColumns&& other) noexcept = default;
+	ReplayColumns& operator=(ReplayColumns&& other) noexcept = default;
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+
+	// Allocates the chunks up front
+	void reserve(size_t frames);
+	// Keeps the allocated chunks so the next recording reuses them
+	void clear() { count = 0; }
+	void release();
+	// Sets the frame count directly, frames past the previous count start out zeroed
+	void resize(size_t frames);
+
+	void push_back(const FrameData& frame);
+	FrameData at(size_t index) const;
+	FrameData back() const { return at(count - 1); }
+
+	// Column access for whole replay scans, chunk by chunk
+	size_t chunkCount() const { return (count + FRAMES_PER_CHUNK - 1) / FRAMES_PER_CHUNK; }
+	const FrameChunk& getChunk(size_t chunk) const { return *chunks[chunk]; }
+	FrameChunk& getChunk(size_t chunk) { return *chunks[chunk]; }
+	size_t chunkFrames(size_t chunk) const
+	{
+		size_t first = chunk * FRAMES_PER_CHUNK;
+		return (count - first < FRAMES_PER_CHUNK) ? count - first : FRAMES_PER_CHUNK;
+	}
+};
@@ -0,0 +1,35 @@
+#pragma once
+#include "Replay.h"
+
+#include <vector>
+
+// Playback position of one bot in one replay, so several bots can play different replays at once.
+// Decoded replays are read in place. Mapped replays share one decoder, so the cursor copies a keyframe
+// interval of frames at a time and never makes another cursor seek the mapping again.
+class ReplayCursor
+{
+	int replay_id = -1;             // Index in the module's replay list, -1 once the cursor is free
+	size_t position = 0;            // Next frame returned by next
+
+	std::vector<FrameData> window;  // Frames of a mapped replay starting at window_start
+	size_t window_start = 0;
+
+public:
+	ReplayCursor() = default;
+	explicit ReplayCursor(int replay_id) : replay_id(replay_id) {}
+
+	int getReplayId() const { return replay_id; }
+	// The module renumbers cursors when a replay before theirs is deleted
+	void setReplayId(int id) { replay_id = id; }
+	bool isFree() const { return replay_id < 0; }
+	size_t getPosition() const { return position; }
+
+	// Returns the frame at the position and moves past it, false at the end of the replay
+	bool next(const Replay& replay, FrameData& frame);
+	// Any frame of the replay, the position is left unchanged. Mapped replays are read through the window.
+	FrameData frameAt(const Replay& replay, size_t index);
+	// False when frame is past the end, the position is left unchanged
+	bool seek(const Replay& replay, size_t frame);
+	void rewind() { position = 0; }
+	void release();
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Bulk kernels for the columnar layout with SSE2 and AVX2 versions picked at runtime, and CRC32C with SSE4.2.
+// The scalar versions are used on other architectures and on CPUs without SSE2.
+class Simd
+{
+public:
+	enum Level
+	{
+		LEVEL_SCALAR = 0,
+		LEVEL_SSE2,
+		LEVEL_AVX2
+	};
+
+	// Best level supported by the CPU and the operating system
+	static Level detectedLevel();
+	static Level activeLevel();
+	// Lowers the level used by the kernels (benchmarks), clamped to the detected level
+	static void setLevel(Level level);
+	static const char* levelName(Level level);
+
+	// values[i] += values[i - 1], starting from carry, returns the last value. Wraps like int16_t.
+	static int16_t prefixSum(int16_t* values, size_t count, int16_t carry);
+	// deltas[i] = values[i] - values[i - 1], with prev before the first value
+	static void delta(const int16_t* values, size_t count, int16_t prev, int16_t* deltas);
+
+	// Zigzag codes the leading deltas that fit a single varint byte (-64 to 63) into output,
+	// returns how many were written. Stops at the first delta that needs more bytes.
+	static size_t zigzagBytes(const int16_t* deltas, size_t count, uint8_t* output);
+	// Inverse of zigzagBytes, stops at the first byte that starts a longer varint
+	static size_t unzigzagBytes(const uint8_t* data, size_t count, int16_t* deltas);
+
+	// SSE4.2 has its own CPUID bit, it is not implied by the level
+	static bool hasCrc32c();
+	// CRC32C (Castagnoli) of data, continuing from a previous crc
+	static uint32_t crc32c(const uint8_t* data, size_t size, uint32_t crc = 0);
+};
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs jobs on a background thread. Each job returns a completion that is
+// queued back and executed on the game thread by poll().
+class Worker
+{
+public:
+	using Completion = std::function<void()>;
+	using Job = std::function<Completion()>;
+
+	~Worker() { stop(); }
+
+	void post(Job job);
+
+	// Runs the finished completions, must be called from the game thread
+	void poll();
+
+	// Finishes the queued jobs, joins the thread and drops pending completions
+	void stop();
+
+private:
+	void run();
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::deque<Job> jobs;
+	std::deque<Completion> completions;
+	bool running = false;
+};
@@ -1,20 +1,60 @@
 #include "amxxmodule.h"  // Include the AMX Mod X headers
 #include "pm_defs.h"
 #include "Replay.h"
+#include "ReplayCache.h"
+#include "ReplayCatalog.h"
+#include "ReplayCursor.h"
 #include "Strafes.h"
+#include "Worker.h"
 
 #include <chrono>
 #include <ctime>
 
 #define DEBUG 0
-#define REPLAY_FPS 60
+#define HEADER_CELLS 195
 
-const int targetIntervalMs = 1000 / REPLAY_FPS;
+// Timestamps are stored in one byte, so the interval between frames stays under 256 ms
+#define MIN_RECORD_RATE 10
+#define MAX_RECORD_RATE 1000
 
 Replay g_Replays[MAX_PLAYERS];
 bool g_bRecording[MAX_PLAYERS];
+
+// Frames per second recorded for each player and the matching interval, set by SetRecordRate
+uint16_t g_iRecordRate[MAX_PLAYERS];
+uint32_t g_iRecordInterval[MAX_PLAYERS];
 std::vector<Replay> g_BotReplays;
 size_t g_iCurrentReplay = 0;
+size_t g_iCurrentFrame = 0;
+
+// Playback cursors of the bots, freed cursors are reused by CreateCursor
+std::vector<ReplayCursor> g_Cursors;
+
+// Bot played by the module every server frame, see BindReplayBot
+struct ReplayBot {
+    int replay_id = -1;         // -1 when the bot isn't bound
+    bool loop = false;
+    float start_time = 0.0f;    // Server time of the first frame
+    float last_time = 0.0f;     // Server time and origin of the previous server frame, for the velocity
+    Vector last_origin;
+    ReplayCursor cursor;        // Frames of a mapped replay, bots on the same replay don't seek it for each other
+};
+ReplayBot g_ReplayBots[MAX_PLAYERS];
+
+std::vector<ReplayCatalog> g_Catalogs;
+
+// Why the last LoadReplay, LoadReplayMapped or LoadReplayAsync failed
+DecodeError g_LastError;
+
+// Lives in tmpfs, not in the module, so decoded replays outlast the changelevel reload
+ReplayCache g_ReplayCache;
+
+Worker g_Worker;
+int g_fwReplayLoaded;
+int g_fwReplaySaved;
+int g_fwReplayBotFinished;
+int g_fwReplayBotLoop;
+int g_fwReplayCatalogReady;
 
 /*
 enum eHeader{
@@ -52,7 +92,41 @@ float FastInvSqrt(float number) {
     return y;
 }
 
-// TODO: Add new thread for loading replays and add a callback function containing the header
+// Copies a null terminated string into a Pawn string of max_length cells
+static void CopyHeaderString(cell* cpString, const char* string, size_t max_length)
+{
+    size_t i = 0;
+    for (; i < max_length - 1 && string[i] != '\0'; ++i)
+        cpString[i] = static_cast<cell>(string[i]);
+    cpString[i] = '\0';
+}
+
+// Copies the header into a Pawn eHeader array
+static void CopyHeader(cell* cpHeader, const Header& header)
+{
+    // Copy scalar values
+    cpHeader[0] = static_cast<cell>(header.timestamp); // timestamp
+    cpHeader[1] = static_cast<cell>(header.version);   // version
+    cpHeader[2] = static_cast<cell>(header.time);      // time
+
+    CopyHeaderString(cpHeader + 3, header.map.c_str(), 64);        // map (index 3, size 64)
+    CopyHeaderString(cpHeader + 67, header.name.c_str(), 64);      // name (index 67, size 64)
+    CopyHeaderString(cpHeader + 131, header.steamID.c_str(), 32);  // steamID (index 131, size 32)
+    CopyHeaderString(cpHeader + 163, header.info.c_str(), 32);     // info (index 163, size 32)
+}
+
+static void CopyHeader(cell* cpHeader, const FixedHeader& header)
+{
+    cpHeader[0] = static_cast<cell>(header.timestamp);
+    cpHeader[1] = static_cast<cell>(header.version);
+    cpHeader[2] = static_cast<cell>(header.time);
+
+    CopyHeaderString(cpHeader + 3, header.map, 64);
+    CopyHeaderString(cpHeader + 67, header.name, 64);
+    CopyHeaderString(cpHeader + 131, header.steamID, 32);
+    CopyHeaderString(cpHeader + 163, header.info, 32);
+}
+
 // native LoadReplay(id, path[], header[eHeader]);
 static cell AMX_NATIVE_CALL LoadReplay(AMX* amx, cell* params)
 {   
@@ -63,52 +137,141 @@ static cell AMX_NATIVE_CALL LoadReplay(AMX* amx, cell* params)
     char* path = MF_GetAmxString(amx, params[2], 0, &path_len);
     MF_BuildPathnameR(buffer, sizeof(buffer), "%s", path);
 
-    // Decode replay file
-    Replay replay = Replay::decode(std::string(buffer, sizeof(buffer)));
+    // Decode replay file, unchanged files come from the cache
+    std::string filename(buffer);
+    Replay replay;
+    bool cached = g_ReplayCache.load(filename, replay);
+    if (!cached)
+        replay = ReplayCatalog::decodeFile(filename);
     Header header = replay.getHeader();
-    
+
+    // The image write and the eviction scan the cache directory, they run on the worker with a copy of the frames
+    if (!cached && replay.size() > 0) {
+        g_Worker.post([filename, image = replay]() mutable -> Worker::Completion {
+            g_ReplayCache.store(filename, image);
+            return nullptr;
+        });
+    }
+
+    // Damaged files are never published as bots
+    g_LastError = replay.getError();
+    if (g_LastError.status != DECODE_OK)
+        return 0;
+
+    replay.buildTimeIndex();
+
 #if DEBUG
     printf("[DEBUG] Loading: \n");
     replay.print();
 #endif
     cell* cpHeader = MF_GetAmxAddr(amx, params[3]);
 
-    // Copy scalar values
-    cpHeader[0] = static_cast<cell>(header.timestamp); // timestamp
-    cpHeader[1] = static_cast<cell>(header.version);   // version
-    cpHeader[2] = static_cast<cell>(header.time);      // time
-    
-    // Copy map string (index 3, size 64)
-    for (size_t i = 0; i < 64 && i < header.map.length(); ++i) {
-        cpHeader[3 + i] = static_cast<cell>(header.map[i]);
-    }
-    cpHeader[3 + header.map.length()] = '\0'; // Null-terminate
-    
-    // Copy name string (index 67, size 64)
-    for (size_t i = 0; i < 64 && i < header.name.length(); ++i) {
-        cpHeader[67 + i] = static_cast<cell>(header.name[i]);
-    }
-    cpHeader[67 + header.name.length()] = '\0'; // Null-terminate
-    
-    // Copy steamID string (index 131, size 32)
-    for (size_t i = 0; i < 32 && i < header.steamID.length(); ++i) {
-        cpHeader[131 + i] = static_cast<cell>(header.steamID[i]);
-    }
-    cpHeader[131 + header.steamID.length()] = '\0'; // Null-terminate
-    
-    // Copy info string (index 163, size 32)
-    for (size_t i = 0; i < 32 && i < header.info.length(); ++i) {
-        cpHeader[163 + i] = static_cast<cell>(header.info[i]);
-    }
-    cpHeader[163 + header.info.length()] = '\0'; // Null-terminate
+    CopyHeader(cpHeader, header);
 
-    g_BotReplays.push_back(replay);
+    g_BotReplays.push_back(std::move(replay));
 
     g_iCurrentReplay = g_BotReplays.size() - 1;
 
     return 1;
 }
 
+// native LoadReplayMapped(id, path[], header[eHeader]);
+static cell AMX_NATIVE_CALL LoadReplayMapped(AMX* amx, cell* params)
+{
+    //int id = params[1]; // NOT USED
+
+    int path_len;
+    char buffer[128];
+    char* path = MF_GetAmxString(amx, params[2], 0, &path_len);
+    MF_BuildPathnameR(buffer, sizeof(buffer), "%s", path);
+
+    // Map the replay file, frames are only decoded when requested
+    Replay replay = Replay::mapFile(std::string(buffer));
+    g_LastError = replay.getError();
+    if (!replay.isMapped())
+        return 0;
+
+    // The time index is built on first use, see TimedReplay
+    cell* cpHeader = MF_GetAmxAddr(amx, params[3]);
+
+    CopyHeader(cpHeader, replay.getHeader());
+
+    g_BotReplays.push_back(std::move(replay));
+
+    g_iCurrentReplay = g_BotReplays.size() - 1;
+
+    return 1;
+}
+
+// native PeekReplayHeader(path[], header[eHeader]);
+static cell AMX_NATIVE_CALL PeekReplayHeader(AMX* amx, cell* params)
+{
+    int path_len;
+    char buffer[128];
+    char* path = MF_GetAmxString(amx, params[1], 0, &path_len);
+    MF_BuildPathnameR(buffer, sizeof(buffer), "%s", path);
+
+    // Only the header bytes are read, the frames are never touched
+    FixedHeader header;
+    if (!Replay::peekHeader(std::string(buffer), header))
+        return 0;
+
+    cell* cpHeader = MF_GetAmxAddr(amx, params[2]);
+    CopyHeader(cpHeader, header);
+
+    return 1;
+}
+
+// native LoadReplayAsync(id, path[]);
+static cell AMX_NATIVE_CALL LoadReplayAsync(AMX* amx, cell* params)
+{
+    int id = params[1];
+
+    int path_len;
+    char buffer[128];
+    char* path = MF_GetAmxString(amx, params[2], 0, &path_len);
+    MF_BuildPathnameR(buffer, sizeof(buffer), "%s", path);
+
+    std::string filename(buffer);
+
+    // File I/O and decoding run on the worker, the replay is published on the game thread
+    g_Worker.post([id, filename]() -> Worker::Completion {
+        Replay replay;
+        bool loaded = false;
+        try {
+            replay = g_ReplayCache.decode(filename);
+            loaded = replay.size() > 0;
+            if (loaded)
+                replay.buildTimeIndex();
+        }
+        catch (const std::exception& e) {
+            fprintf(stderr, "[Replays] Failed to load %s: %s\n", filename.c_str(), e.what());
+        }
+
+        return [id, loaded, replay = std::move(replay)]() mutable {
+            cell cHeader[HEADER_CELLS] = { 0 };
+            int replayId = -1;
+
+            g_LastError = replay.getError();
+            if (!loaded && g_LastError.status == DECODE_OK)
+                g_LastError.status = DECODE_INVALID_DATA;
+
+            if (loaded) {
+                CopyHeader(cHeader, replay.getHeader());
+
+                g_BotReplays.push_back(std::move(replay));
+                replayId = static_cast<int>(g_BotReplays.size() - 1);
+                g_iCurrentReplay = replayId;
+            }
+
+            //forward fwReplayLoaded(id, replayId, header[eHeader]);
+            MF_ExecuteForward(g_fwReplayLoaded, id, replayId, MF_PrepareCellArray(cHeader, HEADER_CELLS));
+        };
+    });
+
+    return 1;
+}
+
 
 void PM_Move(struct playermove_s *pMove, qboolean server) {
     if (pMove->dead)
@@ -149,7 +312,7 @@ void PM_Move(struct playermove_s *pMove, qboolean server) {
         timeSinceLastFpsCount [player]= 0;
     }
 
-    if(playerExecutionTime >= targetIntervalMs) {
+    if(playerExecutionTime >= g_iRecordInterval[player]) {
         // Convert origin and angles (scaled)
         int origin[3] = { static_cast<int>(org.x * 4), static_cast<int>(org.y * 4), static_cast<int>(org.z * 4) };
         int angles[2] = { static_cast<int>(ang.x * 5), static_cast<int>(ang.y * 5) };
@@ -173,7 +336,7 @@ void PM_Move(struct playermove_s *pMove, qboolean server) {
 
 }
 
-// native SaveReplay(path[], id, map, authid, category, time);
+// native SaveReplay(path[], id, map, authid, category, time, reference[] = "");
 static cell AMX_NATIVE_CALL SaveReplay(AMX* amx, cell* params)
 {
     // Get player ID
@@ -194,17 +357,22 @@ static cell AMX_NATIVE_CALL SaveReplay(AMX* amx, cell* params)
 
     // Setup the replay header
     Header header;
-    header.version = 100;
+    header.version = REPLAY_VERSION;
     header.timestamp = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
     header.map = std::string(map, mapLen);
     header.info = std::string(category, categoryLen);
     header.time = time;
     header.name = MF_GetPlayerName(id);
     header.steamID = std::string(authid, authidLen);
+    header.rate = g_iRecordRate[id];
 
     // Set the header for this replay
     g_Replays[id].setHeader(header);
 
+    // Take the recorded frames without copying them, the player can start recording again right away
+    Replay replay = std::move(g_Replays[id]);
+    g_Replays[id] = Replay();
+
 #if DEBUG
     printf("[DEBUG] Saving: \n");
     replay.print();
@@ -213,9 +381,94 @@ static cell AMX_NATIVE_CALL SaveReplay(AMX* amx, cell* params)
     char buffer[128];
     MF_BuildPathnameR(buffer, sizeof(buffer), "%s", std::string(path, pathLen).c_str());
 
-    g_Replays[id].encode(std::string(buffer, 127));
+    std::string filename(buffer);
+    std::string amxPath(path, pathLen);
+
+    // Plugins built against the older include pass six parameters
+    std::string referenceFile;
+    if (params[0] / sizeof(cell) >= 7) {
+        int referenceLen;
+        char* reference = MF_GetAmxString(amx, params[7], 0, &referenceLen);
+        if (referenceLen > 0) {
+            MF_BuildPathnameR(buffer, sizeof(buffer), "%s", reference);
+            referenceFile = buffer;
+        }
+    }
 
-    g_Replays[id].getFrames()->clear();
+    // A new record saved over the old one can't refer to it
+    if (referenceFile == filename)
+        referenceFile.clear();
+
+    // Encoding and writing run on the worker, the catalog file of the directory is updated there too
+    g_Worker.post([id, filename, amxPath, referenceFile, replay = std::move(replay)]() mutable -> Worker::Completion {
+        ReplayCatalog catalog(ReplayCatalog::directoryOf(filename));
+        CatalogEntry kept;
+        CatalogEntry entry;
+        kept.file[0] = '\0';
+        bool saved = false;
+        bool cataloged = false;
+        try {
+            if (!catalog.load())
+                catalog.rebuild();
+
+            // Replays encoded against the record being replaced keep it under another name
+            saved = catalog.keepReferenced(ReplayCatalog::fileOf(filename), replay.contentHash(), kept);
+
+            uint64_t referenceHash = 0;
+            uint16_t formatFlags = 0;
+            if (saved && referenceFile.empty()) {
+                saved = replay.encode(filename);
+            }
+            else if (saved) {
+                // Residuals against a close run only shrink once entropy coded.
+                // A reference that can't be decoded is left out by encode.
+                Replay reference = g_ReplayCache.decode(referenceFile);
+                saved = replay.encode(filename, REPLAY_FLAG_ENTROPY, &reference);
+                formatFlags = REPLAY_FLAG_ENTROPY;
+                if (!reference.isMapped() && !reference.getFrames()->empty()) {
+                    referenceHash = reference.contentHash();
+                    formatFlags |= REPLAY_FLAG_REFERENCE;
+                }
+            }
+
+            // The next map usually loads the replay that was just saved
+            if (saved)
+                g_ReplayCache.store(filename, replay);
+
+            // The entry keeps the header as written, with the format flags of the file
+            Header header = replay.getHeader();
+            header.version = REPLAY_VERSION | formatFlags;
+            replay.setHeader(header);
+
+            cataloged = saved && ReplayCatalog::describe(filename, replay, entry);
+            if (cataloged) {
+                entry.reference_hash = referenceHash;
+                catalog.update(entry);
+            }
+            if (cataloged || kept.file[0] != '\0')
+                cataloged = catalog.save() && cataloged;
+        }
+        catch (const std::exception& e) {
+            fprintf(stderr, "[Replays] Failed to save %s: %s\n", filename.c_str(), e.what());
+            saved = false;
+            cataloged = false;
+        }
+
+        return [id, saved, amxPath, cataloged, entry, kept, directory = catalog.getDirectory()]() {
+            // Catalogs opened by plugins see the new replay without reading the file again
+            for (ReplayCatalog& catalog : g_Catalogs) {
+                if (catalog.getDirectory() != directory)
+                    continue;
+                if (kept.file[0] != '\0')
+                    catalog.update(kept);
+                if (cataloged)
+                    catalog.update(entry);
+            }
+
+            //forward fwReplaySaved(id, success, path[]);
+            MF_ExecuteForward(g_fwReplaySaved, id, saved ? 1 : 0, amxPath.c_str());
+        };
+    });
     
     return 1;
 }
@@ -225,12 +478,48 @@ static cell AMX_NATIVE_CALL StartRecord(AMX* amx, cell* params)
 {
     // Get player ID
     int id = params[1];
+    // The first chunk is allocated here instead of inside PM_Move
     g_Replays[id].getFrames()->clear();
+    g_Replays[id].getFrames()->reserve(FRAMES_PER_CHUNK);
     g_bRecording[id] = true;
 
     return 1;
 }
 
+// Frames are recorded every whole millisecond interval, the header gets the rate that interval really gives
+// (144 records every 6 ms, so 166) and time-indexed playback matches the frames.
+static int ApplyRecordRate(int id, int rate)
+{
+    g_iRecordInterval[id] = 1000 / rate;
+    g_iRecordRate[id] = static_cast<uint16_t>(1000 / g_iRecordInterval[id]);
+    return g_iRecordRate[id];
+}
+
+// native SetRecordRate(id, rate);
+static cell AMX_NATIVE_CALL SetRecordRate(AMX* amx, cell* params)
+{
+    int id = params[1];
+    int rate = params[2];
+    if (id < 0 || id >= MAX_PLAYERS || rate < MIN_RECORD_RATE || rate > MAX_RECORD_RATE)
+        return 0;
+
+    // The header holds a single rate for the whole recording
+    if (g_bRecording[id])
+        return 0;
+
+    return ApplyRecordRate(id, rate);
+}
+
+// native GetReplayRate(replayId);
+static cell AMX_NATIVE_CALL GetReplayRate(AMX* amx, cell* params)
+{
+    int replayId = params[1];
+    if (replayId < 0 || static_cast<size_t>(replayId) >= g_BotReplays.size())
+        return 0;
+
+    return g_BotReplays[replayId].getHeader().rate;
+}
+
 // native StopRecord(id);
 static cell AMX_NATIVE_CALL StopRecord(AMX* amx, cell* params)
 {
@@ -241,44 +530,32 @@ static cell AMX_NATIVE_CALL StopRecord(AMX* amx, cell* params)
     return 1;
 }
 
-// native GetFrame(i, frame[eFrame]);
-static cell AMX_NATIVE_CALL GetFrame(AMX* amx, cell* params)
+// Stored origins are in quarter units and angles in fifths of a degree,
+// every native converts them here so they all return the same floats
+static float OriginValue(int origin)
 {
-    // Get the pointer to the frame array
-    int frameId = params[1];
-    cell* cpFrame = MF_GetAmxAddr(amx, params[2]);
-
-    if(g_BotReplays.empty())
-        return 0;
-
-    if (g_iCurrentReplay >= g_BotReplays.size()) {
-        g_iCurrentReplay = 0;
-    }
-
-    // Get the current replay
-    Replay& currentReplay = g_BotReplays.at(g_iCurrentReplay);
-    auto frames = currentReplay.getFrames(); // Cache reference to frames vector
+    return (float)origin / 4.0;
+}
 
-    if(frames->empty())
-        return 0;
+static float AngleValue(int angle)
+{
+    return (float)angle / 5.0;
+}
 
-    // Get the next frame
-    const FrameData& frame = frames->at(frameId);
-#if DEBUG
-    frame.print();
-#endif
+// Copies the frame into a Pawn eFrame array
+static void CopyFrame(cell* cpFrame, const FrameData& frame)
+{
     const int* originPtr = frame.getOrigin();
     const int* anglesPtr = frame.getAngles();
 
     float origin[3];
-    origin[0] = (float)originPtr[0] / 4.0;
-    origin[1] = (float)originPtr[1] / 4.0;
-    origin[2] = (float)originPtr[2] / 4.0;
+    origin[0] = OriginValue(originPtr[0]);
+    origin[1] = OriginValue(originPtr[1]);
+    origin[2] = OriginValue(originPtr[2]);
 
-    float angles[3];
-    angles[0] = (float)anglesPtr[0] / 5.0;
-    angles[1] = (float)anglesPtr[1] / 5.0;
-    angles[2] = (float)anglesPtr[2] / 5.0;
+    float angles[2];
+    angles[0] = AngleValue(anglesPtr[0]);
+    angles[1] = AngleValue(anglesPtr[1]);
 
     // Copy scalar values into the frame array
     cpFrame[0] = static_cast<cell>(frame.getTimestamp());
@@ -294,10 +571,419 @@ static cell AMX_NATIVE_CALL GetFrame(AMX* amx, cell* params)
     cpFrame[10] = static_cast<cell>(frame.getSync());
     cpFrame[11] = static_cast<cell>(frame.isGrounded());
     cpFrame[12] = static_cast<cell>(frame.hasGravity());
+}
+
+// Returns the current replay, nullptr if no replay is loaded
+static Replay* CurrentReplay()
+{
+    if(g_BotReplays.empty())
+        return nullptr;
+
+    if (g_iCurrentReplay >= g_BotReplays.size()) {
+        g_iCurrentReplay = 0;
+    }
+
+    return &g_BotReplays.at(g_iCurrentReplay);
+}
+
+// native GetFrame(i, frame[eFrame]);
+static cell AMX_NATIVE_CALL GetFrame(AMX* amx, cell* params)
+{
+    // Get the pointer to the frame array
+    int frameId = params[1];
+    cell* cpFrame = MF_GetAmxAddr(amx, params[2]);
+
+    // Get the current replay
+    Replay* currentReplay = CurrentReplay();
+    if (currentReplay == nullptr)
+        return 0;
+
+    if(frameId < 0 || static_cast<size_t>(frameId) >= currentReplay->size())
+        return 0;
+
+    // Get the next frame, mapped replays decode it on demand
+    const FrameData frame = currentReplay->getFrame(frameId);
+#if DEBUG
+    frame.print();
+#endif
+    CopyFrame(cpFrame, frame);
+
+    return 1;
+}
+
+// Row of a two dimensional Pawn array, the first cells hold the byte offset of each row from the cell itself
+static cell* PawnRow(cell* array, size_t row)
+{
+    return reinterpret_cast<cell*>(reinterpret_cast<unsigned char*>(array + row) + array[row]);
+}
+
+// Clamps the range of a batch native to the replay and to the size of the
+// output array, returns the number of frames to copy
+static size_t BatchRange(cell* params, Replay*& replay, size_t& start)
+{
+    int replayId = params[1];
+    if (replayId < 0 || static_cast<size_t>(replayId) >= g_BotReplays.size() || params[2] < 0 || params[3] <= 0 || params[5] <= 0)
+        return 0;
+
+    replay = &g_BotReplays[replayId];
+    start = static_cast<size_t>(params[2]);
+    if (start >= replay->size())
+        return 0;
+
+    size_t count = std::min(static_cast<size_t>(params[3]), static_cast<size_t>(params[5]));
+    return std::min(count, replay->size() - start);
+}
+
+// Calls copy(chunk, i, row) for every frame of the range of a decoded replay, one chunk at a time
+template <typename Copy>
+static void CopyColumns(Replay* replay, size_t start, size_t count, Copy copy)
+{
+    ReplayColumns* frames = replay->getFrames();
+
+    size_t row = 0;
+    while (row < count) {
+        size_t index = start + row;
+        const FrameChunk& chunk = frames->getChunk(index / FRAMES_PER_CHUNK);
+        size_t first = index % FRAMES_PER_CHUNK;
+        size_t last = std::min<size_t>(FRAMES_PER_CHUNK, first + count - row);
+
+        for (size_t i = first; i < last; i++)
+            copy(chunk, i, row++);
+    }
+}
+
+// native GetFrames(replayId, start, count, frames[][eFrame], size = sizeof frames);
+static cell AMX_NATIVE_CALL GetFrames(AMX* amx, cell* params)
+{
+    Replay* replay;
+    size_t start;
+    size_t count = BatchRange(params, replay, start);
+    if (count == 0)
+        return 0;
+
+    cell* cpFrames = MF_GetAmxAddr(amx, params[4]);
+
+    // Mapped replays decode the range sequentially from its keyframe
+    if (replay->isMapped()) {
+        for (size_t row = 0; row < count; row++)
+            CopyFrame(PawnRow(cpFrames, row), replay->getFrame(start + row));
+        return static_cast<cell>(count);
+    }
+
+    // Same conversion as CopyFrame, straight from the columns
+    CopyColumns(replay, start, count, [cpFrames](const FrameChunk& chunk, size_t i, size_t row) {
+        cell* cpFrame = PawnRow(cpFrames, row);
+
+        float values[5] = {
+            OriginValue(chunk.origin[0][i]), OriginValue(chunk.origin[1][i]), OriginValue(chunk.origin[2][i]),
+            AngleValue(chunk.angles[0][i]), AngleValue(chunk.angles[1][i])
+        };
+
+        cpFrame[0] = static_cast<cell>(chunk.timestamp[i]);
+        for (int j = 0; j < 5; j++)
+            cpFrame[1 + j] = amx_ftoc(values[j]);
+        cpFrame[6] = static_cast<cell>(chunk.speed[i]);
+        cpFrame[7] = static_cast<cell>(chunk.fps[i] * 4);
+        cpFrame[8] = static_cast<cell>(FrameData::decompactKeys(chunk.keys[i]));
+        cpFrame[9] = static_cast<cell>(chunk.strafes[i]);
+        cpFrame[10] = static_cast<cell>(chunk.sync[i]);
+        cpFrame[11] = static_cast<cell>((chunk.state[i] & FRAME_STATE_GROUNDED) != 0);
+        cpFrame[12] = static_cast<cell>((chunk.state[i] & FRAME_STATE_GRAVITY) != 0);
+    });
+
+    return static_cast<cell>(count);
+}
+
+// native GetOrigins(replayId, start, count, Float:origins[][3], size = sizeof origins);
+static cell AMX_NATIVE_CALL GetOrigins(AMX* amx, cell* params)
+{
+    Replay* replay;
+    size_t start;
+    size_t count = BatchRange(params, replay, start);
+    if (count == 0)
+        return 0;
+
+    cell* cpOrigins = MF_GetAmxAddr(amx, params[4]);
+
+    if (replay->isMapped()) {
+        for (size_t row = 0; row < count; row++) {
+            const FrameData frame = replay->getFrame(start + row);
+            cell* cpOrigin = PawnRow(cpOrigins, row);
+            for (int axis = 0; axis < 3; axis++) {
+                float value = OriginValue(frame.getOrigin()[axis]);
+                cpOrigin[axis] = amx_ftoc(value);
+            }
+        }
+        return static_cast<cell>(count);
+    }
+
+    CopyColumns(replay, start, count, [cpOrigins](const FrameChunk& chunk, size_t i, size_t row) {
+        cell* cpOrigin = PawnRow(cpOrigins, row);
+        for (int axis = 0; axis < 3; axis++) {
+            float value = OriginValue(chunk.origin[axis][i]);
+            cpOrigin[axis] = amx_ftoc(value);
+        }
+    });
+
+    return static_cast<cell>(count);
+}
+
+// native GetAngles(replayId, start, count, Float:angles[][2], size = sizeof angles);
+static cell AMX_NATIVE_CALL GetAngles(AMX* amx, cell* params)
+{
+    Replay* replay;
+    size_t start;
+    size_t count = BatchRange(params, replay, start);
+    if (count == 0)
+        return 0;
+
+    cell* cpAngles = MF_GetAmxAddr(amx, params[4]);
+
+    if (replay->isMapped()) {
+        for (size_t row = 0; row < count; row++) {
+            const FrameData frame = replay->getFrame(start + row);
+            cell* cpAngle = PawnRow(cpAngles, row);
+            for (int axis = 0; axis < 2; axis++) {
+                float value = AngleValue(frame.getAngles()[axis]);
+                cpAngle[axis] = amx_ftoc(value);
+            }
+        }
+        return static_cast<cell>(count);
+    }
+
+    CopyColumns(replay, start, count, [cpAngles](const FrameChunk& chunk, size_t i, size_t row) {
+        cell* cpAngle = PawnRow(cpAngles, row);
+        for (int axis = 0; axis < 2; axis++) {
+            float value = AngleValue(chunk.angles[axis][i]);
+            cpAngle[axis] = amx_ftoc(value);
+        }
+    });
+
+    return static_cast<cell>(count);
+}
+
+// native GetNextFrame(frame[eFrame]);
+static cell AMX_NATIVE_CALL GetNextFrame(AMX* amx, cell* params)
+{
+    cell* cpFrame = MF_GetAmxAddr(amx, params[1]);
+
+    Replay* currentReplay = CurrentReplay();
+    if (currentReplay == nullptr || g_iCurrentFrame >= currentReplay->size())
+        return 0;
+
+    CopyFrame(cpFrame, currentReplay->getFrame(g_iCurrentFrame));
+    g_iCurrentFrame++;
+
+    return 1;
+}
+
+// native SkipFrames(frames);
+static cell AMX_NATIVE_CALL SkipFrames(AMX* amx, cell* params)
+{
+    int frames = params[1];
+
+    Replay* currentReplay = CurrentReplay();
+    if (currentReplay == nullptr)
+        return 0;
+
+    // Negative values skip backwards, the position is clamped to the replay
+    if (frames < 0 && static_cast<size_t>(-frames) > g_iCurrentFrame)
+        g_iCurrentFrame = 0;
+    else
+        g_iCurrentFrame += frames;
+
+    if (g_iCurrentFrame > currentReplay->size())
+        g_iCurrentFrame = currentReplay->size();
+
+    return static_cast<cell>(g_iCurrentFrame);
+}
+
+// native SeekFrame(replayId, frameId);
+static cell AMX_NATIVE_CALL SeekFrame(AMX* amx, cell* params)
+{
+    int replayId = params[1];
+    int frameId = params[2];
+
+    if (replayId < 0 || static_cast<size_t>(replayId) >= g_BotReplays.size())
+        return 0;
+
+    Replay& replay = g_BotReplays.at(replayId);
+    if (frameId < 0 || static_cast<size_t>(frameId) >= replay.size())
+        return 0;
+
+    g_iCurrentReplay = replayId;
+    g_iCurrentFrame = frameId;
+
+    // Mapped replays decode from the closest keyframe, the next GetNextFrame is then free
+    replay.getFrame(g_iCurrentFrame);
+
+    return 1;
+}
+
+// Returns the cursor and its replay, nullptr if the id is invalid or the cursor was freed
+static ReplayCursor* GetCursor(int cursorId, Replay*& replay)
+{
+    if (cursorId < 0 || static_cast<size_t>(cursorId) >= g_Cursors.size() || g_Cursors[cursorId].isFree())
+        return nullptr;
+
+    ReplayCursor& cursor = g_Cursors[cursorId];
+    replay = &g_BotReplays.at(cursor.getReplayId());
+    return &cursor;
+}
+
+// native CreateCursor(replayId);
+static cell AMX_NATIVE_CALL CreateCursor(AMX* amx, cell* params)
+{
+    int replayId = params[1];
+    if (replayId < 0 || static_cast<size_t>(replayId) >= g_BotReplays.size())
+        return -1;
+
+    for (size_t i = 0; i < g_Cursors.size(); i++) {
+        if (g_Cursors[i].isFree()) {
+            g_Cursors[i] = ReplayCursor(replayId);
+            return static_cast<cell>(i);
+        }
+    }
+
+    g_Cursors.emplace_back(replayId);
+    return static_cast<cell>(g_Cursors.size() - 1);
+}
+
+// native DestroyCursor(cursorId);
+static cell AMX_NATIVE_CALL DestroyCursor(AMX* amx, cell* params)
+{
+    Replay* replay;
+    ReplayCursor* cursor = GetCursor(params[1], replay);
+    if (cursor == nullptr)
+        return 0;
+
+    cursor->release();
+    return 1;
+}
+
+// native CursorNext(cursorId, frame[eFrame]);
+static cell AMX_NATIVE_CALL CursorNext(AMX* amx, cell* params)
+{
+    Replay* replay;
+    ReplayCursor* cursor = GetCursor(params[1], replay);
+    if (cursor == nullptr)
+        return 0;
+
+    FrameData frame;
+    if (!cursor->next(*replay, frame))
+        return 0;
+
+    CopyFrame(MF_GetAmxAddr(amx, params[2]), frame);
+    return 1;
+}
+
+// native CursorSeek(cursorId, frameId);
+static cell AMX_NATIVE_CALL CursorSeek(AMX* amx, cell* params)
+{
+    Replay* replay;
+    ReplayCursor* cursor = GetCursor(params[1], replay);
+    if (cursor == nullptr || params[2] < 0)
+        return 0;
+
+    return cursor->seek(*replay, static_cast<size_t>(params[2])) ? 1 : 0;
+}
+
+// native CursorRewind(cursorId);
+static cell AMX_NATIVE_CALL CursorRewind(AMX* amx, cell* params)
+{
+    Replay* replay;
+    ReplayCursor* cursor = GetCursor(params[1], replay);
+    if (cursor == nullptr)
+        return 0;
+
+    cursor->rewind();
+    return 1;
+}
+
+// native GetCursorPosition(cursorId);
+static cell AMX_NATIVE_CALL GetCursorPosition(AMX* amx, cell* params)
+{
+    Replay* replay;
+    ReplayCursor* cursor = GetCursor(params[1], replay);
+    if (cursor == nullptr)
+        return -1;
+
+    return static_cast<cell>(cursor->getPosition());
+}
+
+// Replay with its time index, built here the first time a mapped replay is played by time.
+// It is one sequential pass over the mapping, later lookups only decode the two frames they blend.
+static Replay& TimedReplay(int replayId)
+{
+    Replay& replay = g_BotReplays[replayId];
+    if (!replay.hasTimeIndex())
+        replay.buildTimeIndex();
+    return replay;
+}
+
+// native BindReplayBot(botId, replayId, bool:loop = true);
+static cell AMX_NATIVE_CALL BindReplayBot(AMX* amx, cell* params)
+{
+    int botId = params[1];
+    int replayId = params[2];
+    if (botId < 1 || botId >= MAX_PLAYERS || !MF_IsPlayerIngame(botId) || !MF_IsPlayerBot(botId))
+        return 0;
+    if (replayId < 0 || static_cast<size_t>(replayId) >= g_BotReplays.size() || TimedReplay(replayId).duration() == 0)
+        return 0;
+
+    edict_t* pEntity = MF_GetPlayerEdict(botId);
+
+    ReplayBot& bot = g_ReplayBots[botId];
+    bot.replay_id = replayId;
+    bot.loop = params[3] != 0;
+    bot.start_time = gpGlobals->time;
+    bot.last_time = gpGlobals->time;
+    bot.last_origin = pEntity->v.origin;
+    bot.cursor.release();
+
+    // The replay moves the bot, its own movement would only fight it
+    pEntity->v.movetype = MOVETYPE_NOCLIP;
+
+    return 1;
+}
+
+// Frees the slot of a bound bot and gives it back its own movement where it stands
+static void ReleaseReplayBot(int botId)
+{
+    if (g_ReplayBots[botId].replay_id < 0)
+        return;
+
+    g_ReplayBots[botId] = ReplayBot();
+
+    if (MF_IsPlayerIngame(botId)) {
+        edict_t* pEntity = MF_GetPlayerEdict(botId);
+        pEntity->v.movetype = MOVETYPE_WALK;
+        pEntity->v.velocity = Vector(0.0f, 0.0f, 0.0f);
+    }
+}
+
+// native UnbindReplayBot(botId);
+static cell AMX_NATIVE_CALL UnbindReplayBot(AMX* amx, cell* params)
+{
+    int botId = params[1];
+    if (botId < 1 || botId >= MAX_PLAYERS || g_ReplayBots[botId].replay_id < 0)
+        return 0;
+
+    ReleaseReplayBot(botId);
 
     return 1;
 }
 
+// native GetBoundReplay(botId);
+static cell AMX_NATIVE_CALL GetBoundReplay(AMX* amx, cell* params)
+{
+    int botId = params[1];
+    if (botId < 1 || botId >= MAX_PLAYERS)
+        return -1;
+
+    return g_ReplayBots[botId].replay_id;
+}
+
 // native GetCurrentReplay();
 static cell AMX_NATIVE_CALL GetCurrentReplay(AMX* amx, cell* params)
 {
@@ -314,6 +1000,7 @@ static cell AMX_NATIVE_CALL SetCurrentReplay(AMX* amx, cell* params)
     if (g_iCurrentReplay >= g_BotReplays.size()) {
         g_iCurrentReplay = 0;  // Loop back to the first replay
     }
+    g_iCurrentFrame = 0;
 
 
     return 1;
@@ -329,6 +1016,7 @@ static cell AMX_NATIVE_CALL NextReplay(AMX* amx, cell* params)
     if (g_iCurrentReplay >= g_BotReplays.size()) {
         g_iCurrentReplay = 0;  // Loop back to the first replay
     }
+    g_iCurrentFrame = 0;
 
 
     return 1;
@@ -341,12 +1029,31 @@ static cell AMX_NATIVE_CALL DeleteReplay(AMX* amx, cell* params)
         return 0;
 
     int replayId = params[1];
+    if (replayId < 0 || static_cast<size_t>(replayId) >= g_BotReplays.size())
+        return 0;
 
     // Delete the current replay
     g_BotReplays.erase(g_BotReplays.begin() + replayId);
 
     g_iCurrentReplay = g_BotReplays.size() - 1;
 
+    // Cursors of the deleted replay are freed, the later replays moved down by one
+    for (ReplayCursor& cursor : g_Cursors) {
+        if (cursor.getReplayId() == replayId)
+            cursor.release();
+        else if (cursor.getReplayId() > replayId)
+            cursor.setReplayId(cursor.getReplayId() - 1);
+    }
+
+    // Bound bots the same way, a bot playing the deleted replay stops where it is
+    for (int id = 1; id < MAX_PLAYERS; id++) {
+        ReplayBot& bot = g_ReplayBots[id];
+        if (bot.replay_id == replayId)
+            ReleaseReplayBot(id);
+        else if (bot.replay_id > replayId)
+            bot.replay_id--;
+    }
+
     return 1;
 }
 
@@ -356,7 +1063,156 @@ static cell AMX_NATIVE_CALL GetReplaySize(AMX* amx, cell* params)
     if (g_BotReplays.empty())
         return 0;
 
-    return g_BotReplays.at(g_iCurrentReplay).getFrames()->size();
+    return g_BotReplays.at(g_iCurrentReplay).size();
+}
+
+// native DecodeStatus:GetReplayError(error[], len);
+static cell AMX_NATIVE_CALL GetReplayError(AMX* amx, cell* params)
+{
+    MF_SetAmxString(amx, params[1], g_LastError.message().c_str(), params[2]);
+    return g_LastError.status;
+}
+
+// native SetReplayCacheBudget(megabytes);
+static cell AMX_NATIVE_CALL SetReplayCacheBudget(AMX* amx, cell* params)
+{
+    int megabytes = params[1];
+    if (megabytes < 0)
+        return 0;
+
+    // Stores run on the worker, the cache serializes them with the budget change
+    g_ReplayCache.setBudget(static_cast<uint64_t>(megabytes) * 1024 * 1024);
+    return 1;
+}
+
+// native ClearReplayCache();
+static cell AMX_NATIVE_CALL ClearReplayCache(AMX* amx, cell* params)
+{
+    g_ReplayCache.clear();
+    return 1;
+}
+
+// native OpenReplayCatalog(directory[]);
+static cell AMX_NATIVE_CALL OpenReplayCatalog(AMX* amx, cell* params)
+{
+    int path_len;
+    char buffer[128];
+    char* path = MF_GetAmxString(amx, params[1], 0, &path_len);
+    MF_BuildPathnameR(buffer, sizeof(buffer), "%s", path);
+
+    std::string directory(buffer);
+    while (directory.size() > 1 && (directory.back() == '/' || directory.back() == '\\'))
+        directory.pop_back();
+
+    size_t catalogId = 0;
+    while (catalogId < g_Catalogs.size() && g_Catalogs[catalogId].getDirectory() != directory)
+        catalogId++;
+
+    if (catalogId == g_Catalogs.size())
+        g_Catalogs.emplace_back(directory);
+
+    // A rebuild already queued publishes the catalog when it's done
+    ReplayCatalog& catalog = g_Catalogs[catalogId];
+    if (catalog.isPending())
+        return static_cast<cell>(catalogId);
+
+    // A missing catalog is built from the replays of the directory on the worker, every replay is decoded.
+    // The catalog stays empty and pending until then, saves queued before the rebuild are part of it.
+    if (!catalog.load()) {
+        catalog.setPending(true);
+        g_Worker.post([catalogId, directory]() -> Worker::Completion {
+            ReplayCatalog rebuilt(directory);
+            try {
+                rebuilt.rebuild();
+                rebuilt.save();
+            }
+            catch (const std::exception& e) {
+                // Published empty, the next OpenReplayCatalog tries again
+                fprintf(stderr, "[Replays] Failed to rebuild the catalog of %s: %s\n", directory.c_str(), e.what());
+                rebuilt = ReplayCatalog(directory);
+            }
+
+            return [catalogId, rebuilt = std::move(rebuilt)]() {
+                if (catalogId >= g_Catalogs.size() || g_Catalogs[catalogId].getDirectory() != rebuilt.getDirectory())
+                    return;
+
+                g_Catalogs[catalogId] = rebuilt;
+
+                //forward fwReplayCatalogReady(catalogId);
+                MF_ExecuteForward(g_fwReplayCatalogReady, static_cast<cell>(catalogId));
+            };
+        });
+    }
+
+    return static_cast<cell>(catalogId);
+}
+
+// native IsCatalogPending(catalogId);
+static cell AMX_NATIVE_CALL IsCatalogPending(AMX* amx, cell* params)
+{
+    size_t catalogId = static_cast<size_t>(params[1]);
+    if (catalogId >= g_Catalogs.size())
+        return 0;
+
+    return g_Catalogs[catalogId].isPending() ? 1 : 0;
+}
+
+// native GetCatalogSize(catalogId);
+static cell AMX_NATIVE_CALL GetCatalogSize(AMX* amx, cell* params)
+{
+    size_t catalogId = static_cast<size_t>(params[1]);
+    if (catalogId >= g_Catalogs.size())
+        return 0;
+
+    return static_cast<cell>(g_Catalogs[catalogId].size());
+}
+
+// native FindCatalogEntries(catalogId, results[], maxResults, CatalogSort:sort, map[], steamID[], category[]);
+static cell AMX_NATIVE_CALL FindCatalogEntries(AMX* amx, cell* params)
+{
+    size_t catalogId = static_cast<size_t>(params[1]);
+    if (catalogId >= g_Catalogs.size())
+        return 0;
+
+    int len;
+    CatalogFilter filter;
+    filter.map = MF_GetAmxString(amx, params[5], 0, &len);
+    filter.steamID = MF_GetAmxString(amx, params[6], 1, &len);
+    filter.info = MF_GetAmxString(amx, params[7], 2, &len);
+
+    std::vector<size_t> found = g_Catalogs[catalogId].find(filter, static_cast<CatalogSort>(params[4]));
+
+    cell* cpResults = MF_GetAmxAddr(amx, params[2]);
+    size_t count = std::min<size_t>(found.size(), params[3] > 0 ? static_cast<size_t>(params[3]) : 0);
+    for (size_t i = 0; i < count; i++)
+        cpResults[i] = static_cast<cell>(found[i]);
+
+    return static_cast<cell>(count);
+}
+
+// native GetCatalogEntry(catalogId, entry, file[], fileLen, header[eHeader], stats[eCatalogStats]);
+static cell AMX_NATIVE_CALL GetCatalogEntry(AMX* amx, cell* params)
+{
+    size_t catalogId = static_cast<size_t>(params[1]);
+    size_t entryId = static_cast<size_t>(params[2]);
+    if (catalogId >= g_Catalogs.size() || entryId >= g_Catalogs[catalogId].size())
+        return 0;
+
+    const CatalogEntry& entry = g_Catalogs[catalogId].at(entryId);
+
+    MF_SetAmxString(amx, params[3], entry.file, params[4]);
+    CopyHeader(MF_GetAmxAddr(amx, params[5]), entry.header);
+
+    cell* cpStats = MF_GetAmxAddr(amx, params[6]);
+    cpStats[0] = static_cast<cell>(entry.frames);
+    cpStats[1] = static_cast<cell>(entry.size);
+    cpStats[2] = static_cast<cell>(entry.modified);
+    cpStats[3] = static_cast<cell>(entry.duration);
+    cpStats[4] = static_cast<cell>(entry.max_speed);
+    cpStats[5] = static_cast<cell>(entry.avg_speed);
+    cpStats[6] = static_cast<cell>(entry.overlaps);
+
+    return 1;
 }
 
 // native GetReplayOverlap(replayId);
@@ -372,26 +1228,106 @@ static cell AMX_NATIVE_CALL GetReplayOverlap(AMX* amx, cell* params)
     return g_BotReplays.at(replayId).overlap();
 }
 
+// native GetFrameAtTime(replayId, Float:time, frame[eFrame]);
+static cell AMX_NATIVE_CALL GetFrameAtTime(AMX* amx, cell* params)
+{
+    int replayId = params[1];
+    if (replayId < 0 || static_cast<size_t>(replayId) >= g_BotReplays.size())
+        return 0;
+
+    // Time is in seconds since the start of the replay, the index is in milliseconds
+    double time = amx_ctof(params[2]) * 1000.0;
+
+    FrameData frame;
+    float origin[3], angles[2];
+    if (!TimedReplay(replayId).frameAtTime(time, frame, origin, angles))
+        return 0;
+
+    cell* cpFrame = MF_GetAmxAddr(amx, params[3]);
+    CopyFrame(cpFrame, frame);
+
+    // Replace the positions of the earlier frame with the blended ones
+    for (int i = 0; i < 3; i++) {
+        float value = origin[i] / 4.0f;
+        cpFrame[1 + i] = amx_ftoc(value);
+    }
+    for (int i = 0; i < 2; i++) {
+        float value = angles[i] / 5.0f;
+        cpFrame[4 + i] = amx_ftoc(value);
+    }
+
+    return 1;
+}
+
+// native Float:GetReplayDuration(replayId);
+static cell AMX_NATIVE_CALL GetReplayDuration(AMX* amx, cell* params)
+{
+    int replayId = params[1];
+    float duration = 0.0f;
+    if (replayId >= 0 && static_cast<size_t>(replayId) < g_BotReplays.size())
+        duration = TimedReplay(replayId).duration() / 1000.0f;
+
+    return amx_ftoc(duration);
+}
+
 
 // Array of native functions to register with AMX Mod X
 AMX_NATIVE_INFO my_natives[] = {
     { "LoadReplay", LoadReplay },
+    { "LoadReplayAsync", LoadReplayAsync },
+    { "LoadReplayMapped", LoadReplayMapped },
+    { "PeekReplayHeader", PeekReplayHeader },
     { "SaveReplay", SaveReplay },
     { "StartRecord", StartRecord },
     { "StopRecord", StopRecord },
+    { "SetRecordRate", SetRecordRate },
+    { "GetReplayRate", GetReplayRate },
     { "GetCurrentReplay", GetCurrentReplay },
     { "SetCurrentReplay", SetCurrentReplay },
     { "GetFrame", GetFrame },
+    { "GetNextFrame", GetNextFrame },
+    { "GetFrames", GetFrames },
+    { "GetOrigins", GetOrigins },
+    { "GetAngles", GetAngles },
+    { "SkipFrames", SkipFrames },
+    { "SeekFrame", SeekFrame },
     { "NextReplay", NextReplay },
     { "DeleteReplay", DeleteReplay },
     { "GetReplaySize", GetReplaySize},
     { "GetReplayOverlap", GetReplayOverlap },
+    { "OpenReplayCatalog", OpenReplayCatalog },
+    { "IsCatalogPending", IsCatalogPending },
+    { "GetCatalogSize", GetCatalogSize },
+    { "FindCatalogEntries", FindCatalogEntries },
+    { "GetCatalogEntry", GetCatalogEntry },
+    { "CreateCursor", CreateCursor },
+    { "DestroyCursor", DestroyCursor },
+    { "CursorNext", CursorNext },
+    { "CursorSeek", CursorSeek },
+    { "CursorRewind", CursorRewind },
+    { "GetCursorPosition", GetCursorPosition },
+    { "GetFrameAtTime", GetFrameAtTime },
+    { "GetReplayDuration", GetReplayDuration },
+    { "BindReplayBot", BindReplayBot },
+    { "UnbindReplayBot", UnbindReplayBot },
+    { "GetBoundReplay", GetBoundReplay },
+    { "GetReplayError", GetReplayError },
+    { "SetReplayCacheBudget", SetReplayCacheBudget },
+    { "ClearReplayCache", ClearReplayCache },
     { nullptr, nullptr }  // Array terminator
 };
 
 void OnAmxxAttach()
 {
     g_fwStrafe = 0;
+    g_fwReplayLoaded = 0;
+    g_fwReplaySaved = 0;
+    g_fwReplayBotFinished = 0;
+    g_fwReplayBotLoop = 0;
+    g_fwReplayCatalogReady = 0;
+
+    for (int i = 0; i < MAX_PLAYERS; i++)
+        ApplyRecordRate(i, DEFAULT_RECORD_RATE);
 
     MF_AddNatives(my_natives);
 }
@@ -400,21 +1336,128 @@ void OnAmxxDetach()
 {
     // This function is necessary, even if you have nothing to declare here. The compiler will throw a linker error otherwise.
     // This can be useful for clearing/destroying a handles system.
+    g_Worker.stop();
 }
 
 void OnPluginsLoaded()
 {   
     //forward fwPlayerStrafe(id, strafes, sync, strafes[32], strafeLen, frames, goodFrames, Float:gain, overlaps, Float:mouseMovement);
 	g_fwStrafe = MF_RegisterForward("fwPlayerStrafe", ET_STOP, FP_CELL, FP_CELL, FP_CELL, FP_ARRAY, FP_CELL, FP_CELL, FP_CELL, FP_CELL, FP_CELL, FP_CELL, FP_DONE);
+    //forward fwReplayLoaded(id, replayId, header[eHeader]);
+    g_fwReplayLoaded = MF_RegisterForward("fwReplayLoaded", ET_IGNORE, FP_CELL, FP_CELL, FP_ARRAY, FP_DONE);
+    //forward fwReplaySaved(id, success, path[]);
+    g_fwReplaySaved = MF_RegisterForward("fwReplaySaved", ET_IGNORE, FP_CELL, FP_CELL, FP_STRING, FP_DONE);
+    //forward fwReplayBotFinished(botId, replayId);
+    g_fwReplayBotFinished = MF_RegisterForward("fwReplayBotFinished", ET_IGNORE, FP_CELL, FP_CELL, FP_DONE);
+    //forward fwReplayBotLoop(botId, replayId);
+    g_fwReplayBotLoop = MF_RegisterForward("fwReplayBotLoop", ET_IGNORE, FP_CELL, FP_CELL, FP_DONE);
+    //forward fwReplayCatalogReady(catalogId);
+    g_fwReplayCatalogReady = MF_RegisterForward("fwReplayCatalogReady", ET_IGNORE, FP_CELL, FP_DONE);
+}
+
+// Moves every bound bot to its replay position at the current server time
+static void PlayReplayBots()
+{
+    float now = gpGlobals->time;
+
+    for (int id = 1; id < MAX_PLAYERS; id++) {
+        ReplayBot& bot = g_ReplayBots[id];
+        if (bot.replay_id < 0)
+            continue;
+
+        double elapsed = (now - bot.start_time) * 1000.0;
+        if (elapsed >= g_BotReplays[bot.replay_id].duration()) {
+            int replayId = bot.replay_id;
+            if (bot.loop) {
+                // Starts over like a new bind, the jump back to the first frame isn't a velocity
+                bot.start_time = now;
+                bot.last_time = now;
+                bot.last_origin = MF_GetPlayerEdict(id)->v.origin;
+                elapsed = 0.0;
+                MF_ExecuteForward(g_fwReplayBotLoop, id, replayId);
+            }
+            else {
+                ReleaseReplayBot(id);
+                MF_ExecuteForward(g_fwReplayBotFinished, id, replayId);
+            }
+
+            // The forward may have unbound the bot or deleted replays
+            if (bot.replay_id < 0)
+                continue;
+        }
+
+        FrameData frame;
+        float origin[3], angles[2];
+        if (!g_BotReplays[bot.replay_id].frameAtTime(elapsed, frame, origin, angles, &bot.cursor))
+            continue;
+
+        edict_t* pEntity = MF_GetPlayerEdict(id);
+        Vector position(origin[0] / 4.0f, origin[1] / 4.0f, origin[2] / 4.0f);
+        Vector view(angles[0] / 5.0f, angles[1] / 5.0f, 0.0f);
+        int buttons = frame.getKeys();
+
+        // Lets the engine run the fake client's frame (animation, weapon) before the replay overrides its position
+        float frametime = now - bot.last_time;
+        unsigned char msec = static_cast<unsigned char>(std::min(frametime * 1000.0f, 255.0f));
+        g_engfuncs.pfnRunPlayerMove(pEntity, view, 0.0f, 0.0f, 0.0f, static_cast<unsigned short>(buttons), 0, msec);
+
+        entvars_t& pev = pEntity->v;
+        SET_ORIGIN(pEntity, position);
+        pev.v_angle = view;
+        pev.angles = Vector(-view[0] / 3.0f, view[1], 0.0f); // Player models tilt a third of the view pitch
+        pev.button = buttons;
+
+        // Clients interpolate and animate the bot from its velocity
+        if (frametime > 0.0f) {
+            for (int axis = 0; axis < 3; axis++)
+                pev.velocity[axis] = (position[axis] - bot.last_origin[axis]) / frametime;
+        }
+
+        if (frame.isGrounded())
+            pev.flags |= FL_ONGROUND;
+        else
+            pev.flags &= ~FL_ONGROUND;
+
+        bot.last_time = now;
+        bot.last_origin = position;
+    }
+}
+
+// Every server frame
+void StartFrame()
+{
+    // Publish the replays finished by the worker
+    g_Worker.poll();
+
+    PlayReplayBots();
+
+    RETURN_META(MRES_IGNORED);
+}
+
+// A bound bot that leaves frees its slot for the next player
+void ClientDisconnect(edict_t* pEntity)
+{
+    int id = ENTINDEX(pEntity);
+    if (id >= 1 && id < MAX_PLAYERS)
+        ReleaseReplayBot(id);
+
+    RETURN_META(MRES_IGNORED);
 }
 
 // Changelevel
 void ServerDeactivate()
 {
+    // Waits for pending saves, loads still in flight belong to the old map
+    g_Worker.stop();
+
     for(int i=0;i<33;i++)
     {
         g_Replays[i].getFrames()->clear();
         g_bRecording[i] = false;
     }
     g_BotReplays.clear();
+    g_Cursors.clear();
+    for (int id = 1; id < MAX_PLAYERS; id++)
+        ReleaseReplayBot(id);
+    g_Catalogs.clear();
 }
\ No newline at end of file
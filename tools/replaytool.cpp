@@ -0,0 +1,456 @@
+// Batch replay tool, processes files and whole directories on a thread pool.
+// Usage: replaytool <command> [-j threads] [-t] [-e] [-c] [-r reference] <file or directory>...
+
+#include "Replay.h"
+#include "ReplayCatalog.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+enum class Command {
+    Header,
+    Frames,
+    Count,
+    Verify,
+    Check,
+    Convert,
+    Catalog
+};
+
+struct Options {
+    Command command = Command::Header;
+    unsigned threads = 0;
+    bool timing = false;
+    uint16_t format_flags = 0;
+    Replay reference;                          // Decoded once, convert stores the differences to it
+    bool has_reference = false;
+    std::vector<std::string> files;
+    std::set<std::string> scanned_directories; // Every replay of these directories is listed
+};
+
+static std::mutex g_OutputMutex;
+
+// Catalog entries collected by the workers, grouped by directory
+static std::mutex g_CatalogMutex;
+static std::map<std::string, std::vector<CatalogEntry>> g_CatalogEntries;
+// Reference replays whose reference may only be in the rebuilt catalog
+static std::map<std::string, std::vector<std::string>> g_PendingReferences;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+        "Usage: %s <command> [-j threads] [-t] [-e] [-c] [-r reference] <file or directory>...\n"
+        "\n"
+        "Commands:\n"
+        "  header   print the header of each replay\n"
+        "  frames   print the header and every frame of each replay\n"
+        "  count    print the frame count of each replay\n"
+        "  verify   fully decode each replay and check it survives a re-encode\n"
+        "  check    only check the block checksums of each replay, nothing is decoded\n"
+        "  convert  re-encode each replay into the current format (version %u)\n"
+        "  catalog  rebuild the catalog of each directory, single files update their entry\n"
+        "\n"
+        "Options:\n"
+        "  -j N     number of worker threads (default: hardware threads)\n"
+        "  -t       print the processing time of each file\n"
+        "  -e       convert: entropy code the frame stream\n"
+        "  -c       convert: store one stream per field (columnar layout)\n"
+        "  -r FILE  convert: store the differences to a replay of the same route, best with -e\n",
+        name, REPLAY_VERSION);
+}
+
+static bool parseCommand(const char* arg, Command& command)
+{
+    if (!strcmp(arg, "header")) command = Command::Header;
+    else if (!strcmp(arg, "frames")) command = Command::Frames;
+    else if (!strcmp(arg, "count")) command = Command::Count;
+    else if (!strcmp(arg, "verify")) command = Command::Verify;
+    else if (!strcmp(arg, "check")) command = Command::Check;
+    else if (!strcmp(arg, "convert")) command = Command::Convert;
+    else if (!strcmp(arg, "catalog")) command = Command::Catalog;
+    else return false;
+
+    return true;
+}
+
+// Directories are scanned recursively, catalogs and temporary files left by an interrupted save are skipped
+static void collectFiles(const std::string& path, Options& options)
+{
+    std::error_code error;
+    if (fs::is_directory(path, error)) {
+        for (const auto& entry : fs::recursive_directory_iterator(path, error)) {
+            if (entry.is_regular_file() && ReplayCatalog::isReplayFile(entry.path().filename().string())) {
+                options.files.push_back(entry.path().string());
+                options.scanned_directories.insert(ReplayCatalog::directoryOf(options.files.back()));
+            }
+        }
+    }
+    else {
+        options.files.push_back(path);
+    }
+}
+
+// Frame records don't keep the side of half a turn, 900 and -900 are the same angle
+static bool sameAngle(int a, int b)
+{
+    return a == b || (a == 900 && b == -900) || (a == -900 && b == 900);
+}
+
+static bool sameFrames(const Replay& a, const Replay& b)
+{
+    if (a.size() != b.size())
+        return false;
+
+    for (size_t i = 0; i < a.size(); i++) {
+        FrameData x = a.getFrame(i);
+        FrameData y = b.getFrame(i);
+
+        if (memcmp(x.getOrigin(), y.getOrigin(), 3 * sizeof(int)) ||
+            !sameAngle(x.getAngles()[0], y.getAngles()[0]) || !sameAngle(x.getAngles()[1], y.getAngles()[1]) ||
+            x.getTimestamp() != y.getTimestamp() || x.getSpeed() != y.getSpeed() || x.getFPS() != y.getFPS() ||
+            x.getKeys() != y.getKeys() || x.getStrafes() != y.getStrafes() || x.getSync() != y.getSync() ||
+            x.isGrounded() != y.isGrounded() || x.hasGravity() != y.hasGravity())
+            return false;
+    }
+
+    return true;
+}
+
+// Returns false when the file failed, message is printed after the file name
+static bool processFile(const Options& options, const std::string& path, std::string& message)
+{
+    if (options.command == Command::Catalog) {
+        CatalogEntry entry;
+        if (!ReplayCatalog::describe(path, entry)) {
+            FixedHeader header;
+            if (Replay::peekHeader(path, header) && (header.version & REPLAY_FLAG_REFERENCE)) {
+                std::lock_guard<std::mutex> lock(g_CatalogMutex);
+                g_PendingReferences[ReplayCatalog::directoryOf(path)].push_back(path);
+                return true;
+            }
+
+            message = "not a replay file";
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(g_CatalogMutex);
+        g_CatalogEntries[ReplayCatalog::directoryOf(path)].push_back(entry);
+        return true;
+    }
+
+    // Listing headers never needs the frames
+    if (options.command == Command::Header) {
+        FixedHeader header;
+        if (!Replay::peekHeader(path, header)) {
+            message = "cannot read header";
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(g_OutputMutex);
+        printf("%s\n", path.c_str());
+        printf("\nTimestamp: %llu\nVersion: %u\nTime: %u\nMap: %s\nName: %s\nSteamID: %s\nINFO: %s\nRate: %u\n\n",
+            static_cast<unsigned long long>(header.timestamp), header.version, header.time,
+            header.map, header.name, header.steamID, header.info, header.rate);
+        return true;
+    }
+
+    std::vector<uint8_t> buffer;
+    if (!Replay::readFile(path, buffer)) {
+        message = "cannot read file";
+        return false;
+    }
+
+    if (buffer.size() < HEADER_BYTE_SIZE) {
+        message = "file is smaller than the header";
+        return false;
+    }
+
+    // The nightly archive check, runs at the speed of the CRC32C instruction
+    if (options.command == Command::Check) {
+        size_t content_size;
+        DecodeError error;
+        if (!Replay::verifyChecksums(buffer.data(), buffer.size(), content_size, error)) {
+            message = error.message();
+            return false;
+        }
+
+        FixedHeader header;
+        Replay::parseHeader(buffer.data(), header);
+        if (replayRevision(header.version) < REPLAY_VERSION_CHECKSUM)
+            message = "no checksums, version " + std::to_string(replayRevision(header.version));
+        return true;
+    }
+
+    Replay replay = Replay::decode(buffer.data(), buffer.size());
+    if (replay.getError().status == DECODE_MISSING_REFERENCE) {
+        if (options.has_reference && replay.getReferenceHash() == options.reference.contentHash())
+            replay = Replay::decode(buffer.data(), buffer.size(), STREAM_ALL, &options.reference);
+        else
+            replay = ReplayCatalog::decodeFile(path);
+    }
+    Header header = replay.getHeader();
+    if (replay.getError().status != DECODE_OK) {
+        message = replay.getError().message();
+        return false;
+    }
+
+    switch (options.command) {
+    case Command::Header:
+    case Command::Frames: {
+        std::lock_guard<std::mutex> lock(g_OutputMutex);
+        printf("%s\n", path.c_str());
+        replay.print();
+        replay.printFrames();
+        return true;
+    }
+    case Command::Count:
+        message = std::to_string(replay.size()) + " frames";
+        return true;
+    case Command::Verify: {
+        // The checksums were verified by decode, only the trailer has to go
+        size_t content_size;
+        DecodeError error;
+        Replay::verifyChecksums(buffer.data(), buffer.size(), content_size, error);
+        buffer.resize(content_size);
+
+        // The keyframe index of an entropy coded replay is inside the coded body
+        if (header.version & REPLAY_FLAG_ENTROPY) {
+            std::vector<uint8_t> image;
+            if (!Replay::decodeEntropy(buffer.data(), buffer.size(), image)) {
+                message = "invalid entropy coded data";
+                return false;
+            }
+            buffer.swap(image);
+        }
+
+        // The alignment runs and the reference trailer follow the keyframe index
+        if (header.version & REPLAY_FLAG_REFERENCE) {
+            size_t frames_end = buffer.size();
+            uint64_t reference_hash;
+            size_t alignment;
+            if (!Replay::decodeReferenceTrailer(buffer.data(), frames_end, reference_hash, alignment)) {
+                message = "invalid reference trailer";
+                return false;
+            }
+            buffer.resize(frames_end);
+        }
+
+        KeyframeIndex index;
+        if (!Replay::decodeKeyframeIndex(buffer.data(), buffer.size(), header.version, index)) {
+            message = "invalid keyframe index";
+            return false;
+        }
+        if (replay.size() == 0) {
+            message = "no frames";
+            return false;
+        }
+        if ((index.interval > 0 || (header.version & REPLAY_FLAG_COLUMNAR)) && replay.size() != index.frame_count) {
+            message = "decoded " + std::to_string(replay.size()) + " frames, index has " + std::to_string(index.frame_count);
+            return false;
+        }
+
+        ByteWriter writer;
+        replay.encode(writer, header.version & ~REPLAY_REVISION_MASK);
+        if (!sameFrames(replay, Replay::decode(writer.data(), writer.size()))) {
+            message = "frames differ after a re-encode";
+            return false;
+        }
+
+        message = "ok, version " + std::to_string(replayRevision(header.version)) + ", " + std::to_string(replay.size()) + " frames";
+        if (header.version & REPLAY_FLAG_COLUMNAR)
+            message += ", columnar";
+        if (header.version & REPLAY_FLAG_ENTROPY)
+            message += ", entropy coded";
+        if (header.version & REPLAY_FLAG_REFERENCE)
+            message += ", reference";
+        return true;
+    }
+    case Command::Convert: {
+        if (replay.size() == 0) {
+            message = "no frames";
+            return false;
+        }
+
+        // The reference itself keeps its frames, it could never be decoded otherwise
+        const Replay* reference = options.has_reference ? &options.reference : nullptr;
+        if (reference != nullptr && replay.contentHash() == reference->contentHash())
+            reference = nullptr;
+
+        uint16_t format_flags = options.format_flags | (reference != nullptr ? REPLAY_FLAG_REFERENCE : 0);
+        uint64_t reference_hash = reference != nullptr ? reference->contentHash() : 0;
+        if (header.version == (REPLAY_VERSION | format_flags) && replay.getReferenceHash() == reference_hash) {
+            message = "already in the requested format";
+            return true;
+        }
+        if (!replay.encode(path, options.format_flags, reference)) {
+            message = "cannot write file";
+            return false;
+        }
+        message = "converted from version " + std::to_string(replayRevision(header.version));
+        if (header.version & REPLAY_FLAG_COLUMNAR)
+            message += " (columnar)";
+        if (header.version & REPLAY_FLAG_ENTROPY)
+            message += " (entropy coded)";
+        if (header.version & REPLAY_FLAG_REFERENCE)
+            message += " (reference)";
+        return true;
+    }
+    case Command::Check:
+    case Command::Catalog:
+        break;
+    }
+
+    return false;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+
+    if (argc < 3 || !parseCommand(argv[1], options.command)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+            options.threads = static_cast<unsigned>(atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "-t")) {
+            options.timing = true;
+        }
+        else if (!strcmp(argv[i], "-e")) {
+            options.format_flags |= REPLAY_FLAG_ENTROPY;
+        }
+        else if (!strcmp(argv[i], "-c")) {
+            options.format_flags |= REPLAY_FLAG_COLUMNAR;
+        }
+        else if (!strcmp(argv[i], "-r") && i + 1 < argc) {
+            options.reference = ReplayCatalog::decodeFile(argv[++i]);
+            if (options.reference.getError().status != DECODE_OK || options.reference.size() == 0) {
+                fprintf(stderr, "%s: cannot decode the reference replay\n", argv[i]);
+                return 1;
+            }
+            options.has_reference = true;
+        }
+        else {
+            collectFiles(argv[i], options);
+        }
+    }
+
+    if (options.files.empty()) {
+        fprintf(stderr, "No replay files found\n");
+        return 1;
+    }
+
+    std::sort(options.files.begin(), options.files.end());
+
+    unsigned threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min<unsigned>(threads, static_cast<unsigned>(options.files.size()));
+
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> failed(0);
+    auto start = std::chrono::steady_clock::now();
+
+    // Each worker takes the next file until the list is exhausted
+    auto worker = [&]() {
+        for (size_t i = next++; i < options.files.size(); i = next++) {
+            const std::string& path = options.files[i];
+            auto file_start = std::chrono::steady_clock::now();
+
+            std::string message;
+            bool ok;
+            try {
+                ok = processFile(options, path, message);
+            }
+            catch (const std::exception& e) {
+                message = e.what();
+                ok = false;
+            }
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - file_start).count();
+
+            if (!ok)
+                failed++;
+
+            if (!message.empty() || options.timing) {
+                std::lock_guard<std::mutex> lock(g_OutputMutex);
+                FILE* out = ok ? stdout : stderr;
+                fprintf(out, "%s: %s%s", path.c_str(), ok ? "" : "FAILED ", message.c_str());
+                if (options.timing)
+                    fprintf(out, " (%.3f ms)", ms);
+                fprintf(out, "\n");
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < threads; i++)
+        pool.emplace_back(worker);
+    for (auto& thread : pool)
+        thread.join();
+
+    // Directories where only reference replays were found still get a catalog
+    for (const auto& directory : g_PendingReferences)
+        g_CatalogEntries[directory.first];
+
+    // Scanned directories get a new catalog, single files are merged into the existing one
+    for (auto& directory : g_CatalogEntries) {
+        ReplayCatalog catalog(directory.first);
+        if (!options.scanned_directories.count(directory.first))
+            catalog.load();
+
+        std::sort(directory.second.begin(), directory.second.end(), [](const CatalogEntry& a, const CatalogEntry& b) {
+            return strcmp(a.file, b.file) < 0;
+        });
+        for (const CatalogEntry& entry : directory.second)
+            catalog.update(entry);
+
+        // Reference replays are described against the new entries, one pass per level of references
+        std::vector<std::string>& pending = g_PendingReferences[directory.first];
+        while (!pending.empty()) {
+            std::vector<std::string> remaining;
+            for (const std::string& path : pending) {
+                CatalogEntry entry;
+                if (ReplayCatalog::describe(path, entry, &catalog))
+                    catalog.update(entry);
+                else
+                    remaining.push_back(path);
+            }
+
+            if (remaining.size() == pending.size())
+                break;
+            pending.swap(remaining);
+        }
+        for (const std::string& path : pending) {
+            fprintf(stderr, "%s: FAILED missing reference replay\n", path.c_str());
+            failed++;
+        }
+
+        if (catalog.save()) {
+            printf("%s/%s: %zu replays\n", directory.first.c_str(), CATALOG_FILENAME, catalog.size());
+        }
+        else {
+            fprintf(stderr, "%s/%s: FAILED cannot write catalog\n", directory.first.c_str(), CATALOG_FILENAME);
+            failed++;
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    fprintf(stderr, "%zu files, %zu failed, %.3f s on %u threads\n", options.files.size(), failed.load(), seconds, threads);
+
+    return failed ? 2 : 0;
+}